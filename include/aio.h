@@ -0,0 +1,36 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+typedef struct aio_req aio_req_t;
+typedef void (*aio_fn_t)(aio_req_t *req);
+
+struct aio_req //一个异步读请求，嵌入到使用者结构体中，回调之前不能释放或修改
+{
+    aio_req_t *next;  //排队时的下一个请求
+    int fd;
+    uint8_t *buf;
+    size_t len;       //要读的长度
+    uint64_t off;     //文件中的起始位置
+    size_t done;      //已经读到的字节数，读到文件末尾时小于len
+    int err;          //出错时的errno，成功为0
+    aio_fn_t fn;      //完成后在aio_poll中调用
+#ifndef _WIN32
+    struct iovec iov; //交给io_uring的缓冲区，提交时指向还没有读到的部分
+#endif
+};
+
+#define aio_entry(req, type, member) ((type *)((uint8_t *)(req) - offsetof(type, member)))
+
+int aio_init();
+void aio_read(aio_req_t *req, int fd, uint8_t *buf, size_t len, uint64_t off, aio_fn_t fn);
+void aio_poll();
+size_t aio_pending();
+
+#endif
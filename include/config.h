@@ -39,6 +39,59 @@
 
 #define IP_DEFALUT_TTL 64 //IP默认TTL
 
+#define TIMER_TICK_MS 10 //时间轮的tick精度
+
+#ifndef NDEBUG
+#define LOG_ENABLE //发布构建(定义NDEBUG)时日志连同参数求值全部编译掉
+#endif
+#define LOG_LEVEL LOG_INFO //编译期保留的最详细级别，更详细的调用不生成代码
+#define LOG_MASK LOG_ALL   //编译期保留的子系统，如(LOG_BIT(LOG_TCP) | LOG_BIT(LOG_HTTP))
+#define LOG_RING_SIZE 256  //日志环形缓冲区的条数，必须是2的幂
+#define LOG_MSG_LEN 120    //单条日志的最大长度
+
+#define TCP_MAX_CONNECT 256       //tcp连接池大小，启动时为每个连接预分配收发缓存，
+                                  //共约TCP_MAX_CONNECT * (TCP_RCV_BUF_LEN + TCP_SND_BUF_LEN)字节，默认约32MB
+#define TCP_MAX_HALF_OPEN 64      //半连接(SYN_RCVD)上限，超过后改用syn cookie不保存状态
+#define TCP_SYN_RTO_MS 1000       //syn和syn-ack的初始重传间隔
+#define TCP_SYN_RETRIES 4         //syn和syn-ack的最大重传次数，超过后放弃连接
+#define TCP_EPHEMERAL_MIN 49152   //主动打开时分配的本地端口范围
+#define TCP_EPHEMERAL_MAX 65535
+#define TCP_HASH_SIZE 16384       //tcp连接表的桶数，必须是2的幂
+#define TCP_LISTEN_HASH_SIZE 64   //tcp监听表的桶数，必须是2的幂
+#define TCP_OOO_MAX_SEG 8 //每个tcp连接最多缓存的乱序区间数
+#define TCP_MSS (ETHERNET_MAX_TRANSPORT_UNIT - 40) //本机tcp最大报文段长度
+#define TCP_RCV_BUF_LEN UINT16_MAX //tcp接收缓存大小，也是最大通告窗口
+#define TCP_SND_BUF_LEN UINT16_MAX //tcp发送缓存大小，存放拷贝写入还没有确认的数据，对端窗口最大UINT16_MAX，再大也发不出去
+#define TCP_DELACK_MS 40      //延迟ack的最长等待时间
+#define TCP_QUICKACK_SEGS 16  //连接建立后立即确认的报文段数，帮助对端尽快走完慢启动
+#define TCP_PERSIST_MIN_MS 200   //零窗口探测的初始间隔
+#define TCP_PERSIST_MAX_MS 60000 //零窗口探测退避的最大间隔
+#define TCP_TXQ_LEN 16             //每个连接发送队列的段数，拷贝写入的数据和零拷贝的zbuf各占一段
+#define TCP_FIN_RTO_MS 1000       //fin的初始重传间隔
+#define TCP_FIN_RETRIES 6         //fin的最大重传次数，超过后放弃连接
+#define TCP_FIN_WAIT_2_MS 60000   //FIN_WAIT_2等待对端fin的最长时间，超过后放弃连接
+#define TCP_TIME_WAIT_MS 60000    //TIME_WAIT的持续时间，即2MSL
+#define TCP_MAX_TIME_WAIT 4096    //TIME_WAIT记录池大小，用满时连接直接关闭
+
+#define HTTP_BACKLOG 128 //http服务器的accept队列长度
+#define HTTP_SERVER_NAME "net"     //响应头中的Server
+#define HTTP_MAX_HEADERS 32        //每个请求最多记录的首部数，多余的被忽略
+#define HTTP_MAX_REQUEST_LEN 8192  //请求行加首部的最大长度，超过时按格式错误处理
+#define HTTP_HEAD_LEN 512          //每个连接的响应头缓存
+#define HTTP_KEEPALIVE_MS 5000     //保持连接时等待下一个请求的空闲超时，也限制第一个请求的到达时间
+#define HTTP_KEEPALIVE_MAX 100     //每个连接最多处理的请求数，最后一个响应带Connection: close
+#define HTTP_PATH_LEN 255          //文档目录加上请求路径的最大长度
+#define HTTP_MAX_RANGES 8          //Range首部最多的区间数，更多时忽略Range发送整个文件
+#define HTTP_CACHE_BYTES (16 * 1024 * 1024) //文件缓存的字节预算，超出时淘汰最久没有使用的文件
+#define HTTP_CACHE_MAX_FILE (1024 * 1024)   //大于此长度的文件不读入缓存，映射后发送
+#define HTTP_CACHE_MAX_MAPPED 64            //保留映射的大文件数，超出时解除最久没有使用的映射
+#define HTTP_ZBUF_MAX (16 * 1024 * 1024)    //每次交给tcp发送队列的最大长度，大文件分成多段，限制队列的总字节数
+#define HTTP_CACHE_HASH_SIZE 256   //文件缓存哈希表的桶数，必须是2的幂
+#define HTTP_CACHE_CHECK_MS 1000   //同一个缓存文件两次检查修改时间的最小间隔
+
+#define AIO_QUEUE_DEPTH 64 //io_uring提交队列的长度，更多的请求在队列外排队
+#define AIO_THREADS 4      //不支持io_uring时读文件的线程数
+
 #define BUF_MAX_LEN (2 * UINT16_MAX + UINT8_MAX) //buf最大长度
 
 #define MAP_MAX_LEN (16 * BUF_MAX_LEN) //map最大长度
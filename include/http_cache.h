@@ -0,0 +1,57 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "config.h"
+#include "tcp.h"
+#include "aio.h"
+
+typedef enum http_encoding //预压缩的变体，和原文件放在同一目录，加上对应的后缀；按服务器的优先顺序排列
+{
+    HTTP_ENCODING_BR,       //.br
+    HTTP_ENCODING_GZIP,     //.gz
+    HTTP_ENCODING_IDENTITY, //原文件，不是变体
+} http_encoding_t;
+
+typedef struct http_wait http_wait_t;
+
+struct http_wait //嵌入到使用者结构体中，等待文件读入完成，用http_wait_entry取回外层结构体
+{
+    http_wait_t *next;
+    void (*fn)(http_wait_t *wait); //读入完成或失败时调用
+};
+
+#define http_wait_entry(wait, type, member) ((type *)((uint8_t *)(wait) - offsetof(type, member)))
+
+typedef struct http_file //缓存的一个文件，内容和元数据放在同一块内存里；大文件的内容是映射的页面
+{
+    struct http_file *hash_next;            //哈希表同一个桶里的下一个文件
+    struct http_file *lru_prev, *lru_next;  //LRU链表，越靠前越近被使用
+    char path[HTTP_PATH_LEN];               //打开文件用的完整路径，也是查找的键
+    size_t size;                            //文件长度
+    time_t mtime;                           //加载时文件的修改时间
+    uint64_t checked;                       //上次确认文件没有变化的时间(ms)
+    uint8_t loading;                        //内容还在异步读入，读完前只能等待
+    uint8_t failed;                         //读入失败，到下次检查前按文件不存在处理
+    uint8_t mapped;                         //内容是映射的页面，不计入缓存的字节预算，数量受HTTP_CACHE_MAX_MAPPED限制
+    http_wait_t *waiters;                   //等待读入完成的连接
+    aio_req_t aio;                          //读入内容的请求
+    uint8_t variants;                       //存在哪些预压缩变体，按http_encoding_t的位，和修改时间一起检查
+    uint8_t head_encoding;                  //head是按哪种编码生成的，同一个文件被直接请求和作为变体发送时响应头不同
+    char head[HTTP_HEAD_LEN];               //预先生成的响应头，head_len为0时由使用者在第一次使用时生成
+    char etag[48];                          //带引号的强校验值，和head一起生成
+    size_t head_len;
+    tcp_zbuf_t zbuf;                        //文件内容，缓存和正在发送它的连接各持有一个引用，全部释放后才回收
+    uint8_t data[];                         //缓存的文件内容，映射的文件没有这部分
+} http_file_t;
+
+void http_cache_init();
+http_file_t *http_cache_get(const char *path);
+http_file_t *http_cache_get_variant(const http_file_t *file, http_encoding_t encoding);
+void http_cache_wait(http_file_t *file, http_wait_t *wait);
+void http_cache_cancel(http_file_t *file, http_wait_t *wait);
+void http_cache_put(http_file_t *file);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "config.h"
+
+typedef struct http_str //请求中的一段文本，用相对请求起点的偏移表示，接收缓存被搬移后依然有效
+{
+    size_t off;
+    size_t len;
+} http_str_t;
+
+typedef struct http_header
+{
+    http_str_t name;
+    http_str_t value; //已去掉首尾空白
+} http_header_t;
+
+typedef enum http_parse_status
+{
+    HTTP_PARSE_AGAIN, //请求还不完整，收到更多数据后用同一个http_req_t继续解析
+    HTTP_PARSE_DONE,  //请求行和全部首部已经解析完
+    HTTP_PARSE_ERROR, //格式错误或请求头过长
+} http_parse_status_t;
+
+typedef struct http_range //Range请求的一个区间，已经按文件长度截断
+{
+    size_t off;
+    size_t len;
+} http_range_t;
+
+typedef struct http_req //增量解析的状态和结果，不拷贝数据，只记录视图
+{
+    size_t scanned;                            //已经找过行尾的字节数，继续解析时从这里开始
+    size_t line;                               //当前行的起点
+    size_t start;                              //请求行的起点，之前的空行被跳过
+    size_t len;                                //解析完成时整个请求头(含结尾空行)的长度
+    int has_line;                              //请求行是否已经解析
+    http_str_t method;
+    http_str_t path;
+    http_str_t version;
+    http_header_t headers[HTTP_MAX_HEADERS];
+    size_t header_count;                       //超过HTTP_MAX_HEADERS的首部被忽略
+} http_req_t;
+
+void http_req_init(http_req_t *req);
+http_parse_status_t http_req_parse(http_req_t *req, const uint8_t *data, size_t len);
+int http_str_eq(const uint8_t *data, http_str_t str, const char *s);
+int http_str_case_eq(const uint8_t *data, http_str_t str, const char *s);
+const http_str_t *http_req_header(const http_req_t *req, const uint8_t *data, const char *name);
+int http_parse_date(const uint8_t *data, http_str_t str, time_t *t);
+int http_etag_match(const uint8_t *data, http_str_t list, const char *etag);
+int http_accept_coding(const uint8_t *data, http_str_t list, const char *coding);
+int http_parse_range(const uint8_t *data, http_str_t str, size_t size, http_range_t *ranges, int max);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+typedef enum log_level //日志级别，数值越大越详细
+{
+    LOG_ERROR = 0,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG,
+} log_level_t;
+
+typedef enum log_sub //产生日志的子系统
+{
+    LOG_ETH = 0,
+    LOG_ARP,
+    LOG_IP,
+    LOG_ICMP,
+    LOG_UDP,
+    LOG_TCP,
+    LOG_HTTP,
+    LOG_SUB_COUNT,
+} log_sub_t;
+
+#define LOG_BIT(sub) (1u << (sub))
+#define LOG_ALL ((1u << LOG_SUB_COUNT) - 1)
+
+#ifdef LOG_ENABLE
+
+/**
+ * @brief 写一条日志
+ *        级别和子系统先按编译期的LOG_LEVEL、LOG_MASK过滤，条件是常量，不满足的调用连同参数求值一起被编译器删掉；
+ *        再按运行时每个子系统的级别过滤，通过的格式化后写入环形缓冲区，由log_flush在主循环里输出
+ */
+#define LOG(sub, level, ...)                                          \
+    do                                                                \
+    {                                                                 \
+        if ((level) <= LOG_LEVEL && (LOG_BIT(sub) & (LOG_MASK)) &&    \
+            (level) <= log_levels[sub])                               \
+            log_write(sub, level, __VA_ARGS__);                       \
+    } while (0)
+
+extern uint8_t log_levels[LOG_SUB_COUNT];
+
+void log_write(log_sub_t sub, log_level_t level, const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 3, 4)))
+#endif
+    ;
+void log_set_level(log_sub_t sub, log_level_t level);
+size_t log_flush();
+
+#else
+
+//发布构建不生成任何日志代码，参数也不会求值
+#define LOG(sub, level, ...) ((void)0)
+#define log_set_level(sub, level) ((void)0)
+#define log_flush() ((size_t)0)
+
+#endif
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "config.h"
+
+typedef struct pool //协议栈的通用定长对象池，启动时一次性分配好内存，之后的分配和释放都只操作空闲链表
+{
+    size_t obj_len;  //对象的长度，已按对齐要求向上取整
+    size_t capacity; //对象总数
+    size_t used;     //已分配的对象数
+    void *free_list; //空闲对象链表，链表指针存放在空闲对象的开头
+    uint8_t *data;   //预分配的内存
+} pool_t;
+
+int pool_init(pool_t *pool, size_t obj_len, size_t capacity);
+void *pool_alloc(pool_t *pool);
+void pool_free(pool_t *pool, void *obj);
+size_t pool_used(pool_t *pool);
+
+#endif
@@ -2,6 +2,7 @@
 #define TCP_H
 
 #include "net.h"
+#include "timer.h"
 
 #pragma pack(1)
 
@@ -18,6 +19,8 @@ typedef struct tcp_flags {
 
 static const tcp_flags_t tcp_flags_null = {};
 static const tcp_flags_t tcp_flags_ack = { .ack = 1 };
+static const tcp_flags_t tcp_flags_syn = { .syn = 1 };
+static const tcp_flags_t tcp_flags_rst = { .rst = 1 };
 static const tcp_flags_t tcp_flags_ack_syn = { .ack = 1 ,.syn = 1 };
 static const tcp_flags_t tcp_flags_ack_fin = { .ack = 1, .fin = 1 };
 static const tcp_flags_t tcp_flags_ack_rst = { .ack = 1 ,.rst = 1 };
@@ -49,7 +52,7 @@ typedef struct tcp_peso_hdr {
 typedef enum tcp_state {
     // 不使用状态 TCP_CLOSED,
     TCP_LISTEN = 0, /* 初始化的状态，没有分配缓存。处于这个状态时 tcp_connect_t 其他字段全是无效的
-                        其他状态rx_buf、tx_buf都在堆上动态分配了缓存，因此释放时要调用释放函数。
+                        其他状态rx_buf、tx_buf都从缓存池分配，因此释放时要调用释放函数。
                     */
     TCP_SYN_SEND,
     TCP_SYN_RCVD,
@@ -62,23 +65,86 @@ typedef enum tcp_state {
     TCP_TIME_WAIT,
 } tcp_state_t;
 
-typedef struct tcp_key {
-    uint8_t ip[NET_IP_LEN];
-    uint16_t src_port;
-    uint16_t dst_port;
-} tcp_key_t;
+// 考虑回绕的序号比较
+#define TCP_SEQ_LT(a, b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)) < 0)
+#define TCP_SEQ_LEQ(a, b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)) <= 0)
+#define TCP_SEQ_GT(a, b) TCP_SEQ_LT(b, a)
+#define TCP_SEQ_GEQ(a, b) TCP_SEQ_LEQ(b, a)
+
+#define TCP_MAX_WINDOW UINT16_MAX // 没有窗口扩大选项时的最大窗口
+
+#define TCP_OPT_END 0       // 选项表结束
+#define TCP_OPT_NOP 1       // 空操作
+#define TCP_OPT_MSS 2       // 最大报文段长度
+#define TCP_OPT_MSS_LEN 4   // mss选项的长度
+#define TCP_DEFAULT_MSS 536 // 对端没有携带mss选项时使用的默认值
+
+typedef struct tcp_zbuf tcp_zbuf_t;
+typedef void (*tcp_zbuf_done_t)(tcp_zbuf_t* zbuf);
+
+// 应用借给协议栈发送的缓存，协议栈在数据被确认之前持有一个引用，引用计数归零时调用done
+struct tcp_zbuf {
+    const uint8_t* data;
+    size_t len;
+    uint32_t ref;         // 引用计数，tcp_zbuf_init之后应用持有一个
+    tcp_zbuf_done_t done; // 缓存可以重用时调用，可以为NULL
+    void* arg;            // 留给应用使用
+};
+
+typedef struct tcp_tx_chunk {
+    tcp_zbuf_t* zbuf; // 为NULL时数据是拷贝进tx_buf的
+    uint32_t off;     // zbuf中尚未确认部分的起始偏移
+    uint32_t len;     // 这一段尚未确认的字节数
+} tcp_tx_chunk_t;
+
+// 连接的收发缓存，按窗口大小从缓存池分配，不需要buf_t那样在头部预留协议头的空间
+typedef struct tcp_buf {
+    uint32_t len;       // 有效数据大小
+    uint32_t size;      // payload的容量
+    uint8_t* data;      // 有效数据起始地址
+    uint8_t payload[];
+} tcp_buf_t;
+
+typedef struct tcp_ooo_seg {
+    uint32_t seq; // 乱序区间的起始序号
+    uint32_t len; // 区间长度
+} tcp_ooo_seg_t;
 
 typedef struct tcp_connect {
+    struct tcp_connect* hash_next; // 连接表同一个桶里的下一个连接
+    struct tcp_connect* accept_next; // accept队列中的下一个连接
+    uint8_t accepting;             // 在监听端口的accept队列中等待tcp_accept
+    uint8_t active;                // 由tcp_connect主动打开，同时打开进入SYN_RCVD后也要通知应用
     tcp_state_t state;
     uint16_t local_port, remote_port;
     uint8_t ip[NET_IP_LEN];
-    uint32_t unack_seq, next_seq; // tx_buf中前[next_seq - unack_seq]字节已经发送，unack_seq未确认的起始序号，next_seq下一发送序号
+    uint32_t unack_seq, next_seq; // 发送队列中前[next_seq - unack_seq]字节已经发送，unack_seq未确认的起始序号，next_seq下一发送序号
     uint32_t ack;
+    uint32_t rcv_wnd_edge; // 已通告的接收窗口右边界，即ack + 通告窗口
     uint16_t remote_mss;
     uint16_t remote_win;
     void* handler;
-    buf_t* rx_buf; // 接收缓存
-    buf_t* tx_buf; // 发送缓存
+    void* arg;             // 留给应用使用，例如关联应用层的连接状态
+    tcp_buf_t* rx_buf; // 接收缓存，容量TCP_RCV_BUF_LEN
+    tcp_buf_t* tx_buf; // 发送缓存，存放拷贝写入的数据，容量TCP_SND_BUF_LEN
+    tcp_tx_chunk_t txq[TCP_TXQ_LEN]; // 发送队列，按序号排列，每段是tx_buf中的一段拷贝数据或者一个zbuf
+    uint8_t txq_head, txq_count;
+    uint32_t tx_len;               // 发送队列的总字节数，即已发送未确认加上未发送的部分
+    tcp_ooo_seg_t ooo[TCP_OOO_MAX_SEG]; // 乱序到达的区间，按序号排序且互不重叠，数据已按偏移放在rx_buf有效数据之后
+    uint8_t ooo_count;
+    uint8_t quickack;      // 剩余的立即确认次数
+    uint32_t ack_sent;     // 最近一次发出的ack序号，ack - ack_sent即尚未确认的字节数
+    timer_node_t ack_timer; // 延迟ack定时器，启动时有待发送的ack
+    uint8_t fin_pending;   // 应用已关闭连接，发送队列中的数据发完后要发送fin
+    uint8_t nodelay;       // 关闭Nagle算法，不满一段的数据也立即发送
+    uint8_t cork;          // 只发送满段，直到取消cork或者关闭连接
+    uint8_t want_write;    // 上次写入因发送缓存或发送队列已满而不完整，确认腾出空间后通知TCP_CONN_DATA_SENT
+    uint8_t persist_backoff;   // 零窗口探测的退避次数，不为0时有一个探测字节在途
+    timer_node_t persist_timer; // 零窗口探测的坚持定时器
+    uint8_t syn_retries;        // syn或syn-ack已经重传的次数
+    timer_node_t syn_timer;     // syn或syn-ack重传定时器
+    uint8_t fin_retries;        // fin已经重传的次数
+    timer_node_t fin_timer;     // 关闭定时器，FIN_WAIT_1、CLOSING、LAST_ACK中重传fin，FIN_WAIT_2中限制等待对端fin的时间
 } tcp_connect_t;
 
 static const tcp_connect_t CONNECT_LISTEN = {
@@ -88,20 +154,39 @@ static const tcp_connect_t CONNECT_LISTEN = {
 typedef enum connect_state {
     // 刚刚建立连接
     TCP_CONN_CONNECTED,
-    // 收到数据
+    // 收到数据；对端关闭发送方向时也会收到，此时连接的state为TCP_CLOSE_WAIT，应用发完数据后调用tcp_connect_close
     TCP_CONN_DATA_RECV,
     // 关闭连接
     TCP_CONN_CLOSED,
+    // 发送缓存腾出了空间，之前没有写完的数据可以继续写入
+    TCP_CONN_DATA_SENT,
 } connect_state_t;
 
 typedef void (*tcp_handler_t)(tcp_connect_t* conect, connect_state_t state);
 
+typedef enum tcp_conn_opt {
+    TCP_CONN_NODELAY, // 关闭Nagle算法
+    TCP_CONN_CORK,    // 攒满一段再发送
+} tcp_conn_opt_t;
+
 void tcp_init();
 int tcp_open(uint16_t port, tcp_handler_t handler);
+int tcp_listen(uint16_t port, size_t backlog, tcp_handler_t handler);
+tcp_connect_t* tcp_accept(uint16_t port);
+size_t tcp_listen_drops(uint16_t port);
 void tcp_close(uint16_t port);
+tcp_connect_t* tcp_connect(const uint8_t* ip, uint16_t port, tcp_handler_t handler);
 void tcp_connect_close(tcp_connect_t* connect);
 size_t tcp_connect_write(tcp_connect_t* connect, const uint8_t* data, size_t len);
 size_t tcp_connect_read(tcp_connect_t* connect, uint8_t* data, size_t len);
+size_t tcp_connect_peek(tcp_connect_t* connect, const uint8_t** data);
+void tcp_connect_consume(tcp_connect_t* connect, size_t len);
+void tcp_connect_setopt(tcp_connect_t* connect, tcp_conn_opt_t opt, int value);
+void tcp_zbuf_init(tcp_zbuf_t* zbuf, const uint8_t* data, size_t len, tcp_zbuf_done_t done, void* arg);
+void tcp_zbuf_get(tcp_zbuf_t* zbuf);
+void tcp_zbuf_put(tcp_zbuf_t* zbuf);
+int tcp_connect_write_zbuf(tcp_connect_t* connect, tcp_zbuf_t* zbuf, size_t off, size_t len);
 void tcp_in(buf_t* buf, uint8_t* src_ip);
+void tcp_poll();
 
 #endif
@@ -0,0 +1,50 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+#define TIMER_LEVELS 4                            //时间轮的层数
+#define TIMER_SLOT_BITS 6                         //每层槽数的位数
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)        //每层的槽数
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+
+typedef struct timer_node timer_node_t;
+typedef void (*timer_fn_t)(timer_node_t *node);
+
+struct timer_node //嵌入到使用者结构体中的定时器，用timer_entry取回外层结构体
+{
+    timer_node_t *next;   //同一个槽中的下一个定时器
+    timer_node_t **pprev; //指向前一个定时器的next，为NULL表示定时器未启动
+    uint64_t expire;      //到期的tick
+    timer_fn_t fn;        //到期时调用的函数
+};
+
+typedef struct timer_wheel //分层时间轮，添加、删除为O(1)，到期检查只看当前tick对应的槽
+{
+    uint64_t tick;                                      //下一个要处理的tick
+    size_t count;                                       //已启动的定时器数
+    timer_node_t *slots[TIMER_LEVELS][TIMER_SLOTS];     //第n层每个槽跨越TIMER_SLOTS^n个tick
+} timer_wheel_t;
+
+#define timer_entry(node, type, member) ((type *)((uint8_t *)(node) - offsetof(type, member)))
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now);
+void timer_node_init(timer_node_t *node, timer_fn_t fn);
+void timer_add(timer_wheel_t *wheel, timer_node_t *node, uint64_t expire_ms);
+void timer_del(timer_wheel_t *wheel, timer_node_t *node);
+void timer_wheel_run(timer_wheel_t *wheel, uint64_t now);
+
+/**
+ * @brief 定时器是否已经启动
+ * 
+ * @param node 
+ * @return int 
+ */
+static inline int timer_pending(const timer_node_t *node)
+{
+    return node->pprev != NULL;
+}
+
+#endif
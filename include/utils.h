@@ -27,6 +27,12 @@ static inline uint32_t min32(uint32_t a, uint32_t b) {
 char *iptos(uint8_t *ip);
 char *mactos(uint8_t *mac);
 char *timetos(time_t timestamp);
+uint64_t time_ms();
+#ifdef TEST
+extern uint64_t test_time_ms;
+#endif
+void random_bytes(uint8_t *buf, size_t len);
+uint64_t siphash24(const uint8_t key[16], const uint8_t *data, size_t len);
 uint8_t ip_prefix_match(uint8_t *ipa, uint8_t *ipb);
 
 
@@ -0,0 +1,353 @@
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "aio.h"
+#include "log.h"
+#ifdef _WIN32
+#include <io.h>
+#include <limits.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+static int aio_ready;          //是否已经初始化
+static size_t aio_inflight;    //已提交、还没有回调的请求数
+
+/**
+ * @brief 同步读完一个请求，工作线程和没有线程可用时调用
+ *
+ * @param req
+ */
+static void aio_read_sync(aio_req_t *req)
+{
+    while (req->done < req->len)
+    {
+#ifdef _WIN32
+        size_t n = req->len - req->done;
+        if (_lseeki64(req->fd, req->off + req->done, SEEK_SET) < 0)
+        {
+            req->err = errno;
+            return;
+        }
+        int got = _read(req->fd, req->buf + req->done, n > INT_MAX ? INT_MAX : (unsigned)n);
+#else
+        ssize_t got = pread(req->fd, req->buf + req->done, req->len - req->done, req->off + req->done);
+#endif
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+        {
+            req->err = errno;
+            return;
+        }
+        if (got == 0)
+            return;
+        req->done += got;
+    }
+}
+
+/**
+ * @brief 不支持io_uring时的线程池，工作线程做阻塞的pread，完成的请求放进done链表，由aio_poll在主线程回调
+ *        一个线程也启动不了时退化为在aio_read中同步读，回调仍然推迟到aio_poll
+ */
+static pthread_t pool_threads[AIO_THREADS];
+static int pool_thread_count;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static aio_req_t *todo_head, *todo_tail; //等待工作线程处理的请求
+static aio_req_t *done_head, *done_tail; //已经读完、等待回调的请求
+
+static void aio_list_push(aio_req_t **head, aio_req_t **tail, aio_req_t *req)
+{
+    req->next = NULL;
+    if (*tail)
+        (*tail)->next = req;
+    else
+        *head = req;
+    *tail = req;
+}
+
+static void *aio_worker(void *arg)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&pool_lock);
+        while (todo_head == NULL)
+            pthread_cond_wait(&pool_cond, &pool_lock);
+        aio_req_t *req = todo_head;
+        todo_head = req->next;
+        if (todo_head == NULL)
+            todo_tail = NULL;
+        pthread_mutex_unlock(&pool_lock);
+
+        aio_read_sync(req);
+
+        pthread_mutex_lock(&pool_lock);
+        aio_list_push(&done_head, &done_tail, req);
+        pthread_mutex_unlock(&pool_lock);
+    }
+    return NULL;
+}
+
+static void aio_pool_submit(aio_req_t *req)
+{
+    if (pool_thread_count == 0)
+    {
+        aio_read_sync(req);
+        aio_list_push(&done_head, &done_tail, req);
+        return;
+    }
+    pthread_mutex_lock(&pool_lock);
+    aio_list_push(&todo_head, &todo_tail, req);
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void aio_pool_poll()
+{
+    pthread_mutex_lock(&pool_lock);
+    aio_req_t *req = done_head;
+    done_head = done_tail = NULL;
+    pthread_mutex_unlock(&pool_lock);
+
+    while (req)
+    {
+        aio_req_t *next = req->next;
+        aio_inflight--;
+        req->fn(req);
+        req = next;
+    }
+}
+
+#ifdef __linux__
+
+/**
+ * @brief io_uring后端，直接用系统调用，不依赖liburing
+ *        提交队列只由主线程写，完成队列只由主线程读，和内核之间用acquire/release同步下标
+ */
+static struct aio_ring
+{
+    int fd;                     //为-1时使用线程池
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries, cq_entries;
+    unsigned queued;            //已经放进提交队列、还没有收割的请求数，不超过完成队列的长度
+    unsigned unsubmitted;       //放进提交队列但还没有交给内核的请求数
+    aio_req_t *wait_head, *wait_tail; //队列满时排队的请求
+} ring = {.fd = -1};
+
+static int aio_ring_init()
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, AIO_QUEUE_DEPTH, &p);
+    if (fd < 0)
+        return -1;
+
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    size_t sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    uint8_t *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    uint8_t *cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        if (sq != MAP_FAILED)
+            munmap(sq, sq_len);
+        if (cq != MAP_FAILED)
+            munmap(cq, cq_len);
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_len);
+        close(fd);
+        return -1;
+    }
+
+    ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    ring.sqes = sqes;
+    ring.sq_entries = p.sq_entries;
+    ring.cq_entries = p.cq_entries;
+    ring.fd = fd;
+    return 0;
+}
+
+/**
+ * @brief 把排队的请求放进提交队列并交给内核
+ *        已放进队列的请求数不超过完成队列的长度，完成事件就不会溢出
+ */
+static void aio_ring_flush()
+{
+    while (ring.wait_head && ring.queued < ring.cq_entries)
+    {
+        unsigned tail = *ring.sq_tail;
+        unsigned head = atomic_load_explicit((_Atomic unsigned *)ring.sq_head, memory_order_acquire);
+        if (tail - head == ring.sq_entries)
+            break;
+        aio_req_t *req = ring.wait_head;
+        ring.wait_head = req->next;
+        if (ring.wait_head == NULL)
+            ring.wait_tail = NULL;
+
+        unsigned idx = tail & *ring.sq_mask;
+        struct io_uring_sqe *sqe = &ring.sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        req->iov.iov_base = req->buf + req->done;
+        req->iov.iov_len = req->len - req->done;
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = req->fd;
+        sqe->addr = (uintptr_t)&req->iov;
+        sqe->len = 1;
+        sqe->off = req->off + req->done;
+        sqe->user_data = (uintptr_t)req;
+        ring.sq_array[idx] = idx;
+        atomic_store_explicit((_Atomic unsigned *)ring.sq_tail, tail + 1, memory_order_release);
+        ring.queued++;
+        ring.unsubmitted++;
+    }
+    if (ring.unsubmitted > 0)
+    {
+        int n = syscall(__NR_io_uring_enter, ring.fd, ring.unsubmitted, 0, 0, NULL, 0);
+        //内核暂时拿不到资源时留在提交队列里，下次aio_poll再交
+        if (n > 0)
+            ring.unsubmitted -= n;
+    }
+}
+
+/**
+ * @brief 收割完成队列，读了一部分或被打断的请求重新排队，读完的请求回调
+ */
+static void aio_ring_poll()
+{
+    aio_req_t *done = NULL, *done_last = NULL;
+    unsigned head = *ring.cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)ring.cq_tail, memory_order_acquire);
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        aio_req_t *req = (aio_req_t *)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        head++;
+        ring.queued--;
+        if (res == -EINTR || res == -EAGAIN || (res > 0 && req->done + res < req->len))
+        {
+            if (res > 0)
+                req->done += res;
+            aio_list_push(&ring.wait_head, &ring.wait_tail, req);
+            continue;
+        }
+        if (res < 0)
+            req->err = -res;
+        else
+            req->done += res;
+        aio_list_push(&done, &done_last, req);
+    }
+    atomic_store_explicit((_Atomic unsigned *)ring.cq_head, head, memory_order_release);
+    aio_ring_flush();
+
+    //回调可能提交新的请求，收割完以后再调用
+    while (done)
+    {
+        aio_req_t *next = done->next;
+        aio_inflight--;
+        done->fn(done);
+        done = next;
+    }
+}
+
+#endif
+
+/**
+ * @brief 初始化异步读，优先使用io_uring，不支持时启动线程池
+ *
+ * @return int 成功为0；线程也启动不了时为-1，此时aio_read同步读，仍然可以使用
+ */
+int aio_init()
+{
+    if (aio_ready)
+        return 0;
+    aio_ready = 1;
+#ifdef __linux__
+    if (aio_ring_init() == 0)
+    {
+        LOG(LOG_HTTP, LOG_INFO, "aio: io_uring, %u entries", ring.sq_entries);
+        return 0;
+    }
+#endif
+    while (pool_thread_count < AIO_THREADS && pthread_create(&pool_threads[pool_thread_count], NULL, aio_worker, NULL) == 0)
+        pool_thread_count++;
+    LOG(LOG_HTTP, LOG_INFO, "aio: %d threads", pool_thread_count);
+    return pool_thread_count > 0 ? 0 : -1;
+}
+
+/**
+ * @brief 提交一个异步读，读满len、读到文件末尾或出错后在aio_poll中调用fn
+ *
+ * @param req 调用者提供，回调之前不能释放
+ * @param fd 回调之前不能关闭
+ * @param buf
+ * @param len
+ * @param off 文件中的起始位置
+ * @param fn
+ */
+void aio_read(aio_req_t *req, int fd, uint8_t *buf, size_t len, uint64_t off, aio_fn_t fn)
+{
+    req->fd = fd;
+    req->buf = buf;
+    req->len = len;
+    req->off = off;
+    req->done = 0;
+    req->err = 0;
+    req->fn = fn;
+    aio_inflight++;
+#ifdef __linux__
+    if (ring.fd >= 0)
+    {
+        aio_list_push(&ring.wait_head, &ring.wait_tail, req);
+        aio_ring_flush();
+        return;
+    }
+#endif
+    aio_pool_submit(req);
+}
+
+/**
+ * @brief 在主循环中和收发包一起调用，回调已经完成的请求
+ *
+ */
+void aio_poll()
+{
+    if (aio_inflight == 0)
+        return;
+#ifdef __linux__
+    if (ring.fd >= 0)
+    {
+        aio_ring_poll();
+        return;
+    }
+#endif
+    aio_pool_poll();
+}
+
+/**
+ * @brief 已提交、还没有回调的请求数
+ *
+ * @return size_t
+ */
+size_t aio_pending()
+{
+    return aio_inflight;
+}
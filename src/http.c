@@ -1,88 +1,317 @@
 #include "http.h"
+#include "http_parser.h"
+#include "http_cache.h"
 #include "tcp.h"
 #include "net.h"
+#include "pool.h"
+#include "timer.h"
+#include "log.h"
 #include "assert.h"
+#include <ctype.h>
 
-#define TCP_FIFO_SIZE 40
+typedef enum http_state {
+    HTTP_READ_REQUEST, // 等待完整的请求头，空闲超时定时器在这个状态下启动
+    HTTP_OPEN_FILE,    // 请求头完整，等待文件异步读入，读完后重新处理同一个请求
+    HTTP_SEND_HEADER,  // 写响应头
+    HTTP_SEND_BODY,    // 把文件内容作为zbuf交给tcp
+    HTTP_DONE,         // 响应已全部写入，保持连接时回到HTTP_READ_REQUEST，否则关闭
+} http_state_t;
 
-typedef struct http_fifo {
-    tcp_connect_t* buffer[TCP_FIFO_SIZE];
-    uint8_t front, tail, count;
-} http_fifo_t;
+typedef struct http_conn {  // 一个http连接的状态，由tcp的收发事件推进，不在任何地方阻塞
+    tcp_connect_t* tcp;
+    http_state_t state;
+    http_req_t req;         // 请求头的增量解析状态
+    uint8_t keep_alive;     // 当前响应之后是否保持连接
+    uint32_t requests;      // 这个连接上已经开始处理的请求数
+    timer_node_t idle_timer; // 等待下一个请求的空闲超时
+    http_file_t* file;      // 正在发送或等待读入的文件，缓存的或者映射的，持有一个引用，没有时为NULL
+    http_wait_t wait;       // 在HTTP_OPEN_FILE状态下等待file读入
+    const char* type;       // 按请求路径确定的Content-Type，发送预压缩变体时也不变
+    http_encoding_t encoding; // 发送的是原文件还是哪个预压缩变体
+    uint8_t vary;           // 这种类型可能有预压缩变体，响应要带Vary: Accept-Encoding
+    http_range_t ranges[HTTP_MAX_RANGES]; // 要发送的文件区间，200响应是整个文件
+    int range_count, range_idx;
+    uint8_t multipart;      // 多个区间，用multipart/byteranges发送，每个区间前有分隔行
+    size_t body_off;        // 当前区间中已经交给tcp的字节数
+    char head[HTTP_HEAD_LEN]; // 响应头，404时连同内容一起；多段响应在发送内容时用来放分隔行
+    size_t head_len, head_off;
+} http_conn_t;
 
-static http_fifo_t http_fifo_v;
+static uint16_t http_port;  //服务器监听的端口
+static pool_t http_pool;    //http连接池，每个tcp连接最多对应一个
+static timer_wheel_t http_timers; //http连接的空闲超时
+static char http_boundary[24]; //multipart/byteranges的分隔串，启动时随机生成
 
-static void http_fifo_init(http_fifo_t* fifo) {
-    fifo->count = 0;
-    fifo->front = 0;
-    fifo->tail = 0;
+/**
+ * @brief 回收http状态，tcp连接由调用者处理
+ *
+ * @param conn
+ */
+static void free_http(http_conn_t* conn) {
+    if (conn->file != NULL) {
+        if (conn->state == HTTP_OPEN_FILE)
+            http_cache_cancel(conn->file, &conn->wait);
+        http_cache_put(conn->file);
+    }
+    timer_del(&http_timers, &conn->idle_timer);
+    conn->tcp->arg = NULL;
+    pool_free(&http_pool, conn);
 }
 
-static int http_fifo_in(http_fifo_t* fifo, tcp_connect_t* tcp) {
-    if (fifo->count >= TCP_FIFO_SIZE) {
-        return -1;
-    }
-    fifo->buffer[fifo->front] = tcp;
-    fifo->front++;
-    if (fifo->front >= TCP_FIFO_SIZE) {
-        fifo->front = 0;
+static void close_http(http_conn_t* conn) {
+    tcp_connect_t* tcp = conn->tcp;
+    LOG(LOG_HTTP, LOG_DEBUG, "close %s:%u after %u requests", iptos(tcp->ip), tcp->remote_port, conn->requests);
+    free_http(conn);
+    tcp_connect_close(tcp);
+}
+
+/**
+ * @brief 空闲超时，在限定时间内没有收到完整请求的连接被关闭
+ *
+ * @param node
+ */
+static void http_idle_timer(timer_node_t* node) {
+    close_http(timer_entry(node, http_conn_t, idle_timer));
+}
+
+typedef struct http_mime {
+    const char* ext;   // 小写的扩展名，不含点
+    const char* type;
+    uint8_t compress;  // 文本类的资源，会查找.br和.gz预压缩变体
+} http_mime_t;
+
+static const http_mime_t mime_table[] = {
+    {"html", "text/html; charset=utf-8", 1},
+    {"htm", "text/html; charset=utf-8", 1},
+    {"css", "text/css; charset=utf-8", 1},
+    {"js", "application/javascript; charset=utf-8", 1},
+    {"json", "application/json", 1},
+    {"txt", "text/plain; charset=utf-8", 1},
+    {"xml", "application/xml", 1},
+    {"jpg", "image/jpeg", 0},
+    {"jpeg", "image/jpeg", 0},
+    {"png", "image/png", 0},
+    {"gif", "image/gif", 0},
+    {"svg", "image/svg+xml", 1},
+    {"ico", "image/x-icon", 0},
+    {"webp", "image/webp", 0},
+    {"woff2", "font/woff2", 0},
+    {"pdf", "application/pdf", 0},
+};
+
+static const http_mime_t mime_default = {"", "application/octet-stream", 0};
+
+static const char* encoding_name[] = {"br", "gzip"}; // 按http_encoding_t排列
+
+/**
+ * @brief 按扩展名查找Content-Type，不区分大小写
+ *
+ * @param path
+ * @return const http_mime_t* 未知的扩展名为application/octet-stream
+ */
+static const http_mime_t* mime_type(const char* path) {
+    const char* dot = strrchr(path, '.');
+    if (dot == NULL || strchr(dot, '/') != NULL)
+        return &mime_default;
+
+    //扩展名转成小写再比较，比表中最长的还长的扩展名不会匹配
+    char ext[8];
+    size_t n = 0;
+    for (const char* c = dot + 1; *c && n < sizeof(ext) - 1; c++)
+        ext[n++] = tolower((uint8_t)*c);
+    ext[n] = '\0';
+    for (size_t i = 0; i < sizeof(mime_table) / sizeof(mime_table[0]); i++) {
+        if (strcmp(ext, mime_table[i].ext) == 0)
+            return &mime_table[i];
     }
-    fifo->count++;
-    return 0;
+    return &mime_default;
 }
 
-static tcp_connect_t* http_fifo_out(http_fifo_t* fifo) {
-    if (fifo->count == 0) {
-        return NULL;
+/**
+ * @brief 按RFC 7231的IMF-fixdate格式化时间，不受locale影响
+ *
+ * @param buf 至少32字节
+ * @param t
+ */
+static void http_date(char* buf, time_t t) {
+    static const char* days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char* months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    struct tm* tm = gmtime(&t);
+    snprintf(buf, 32, "%s, %02d %s %04d %02d:%02d:%02d GMT", days[tm->tm_wday], tm->tm_mday, months[tm->tm_mon],
+        tm->tm_year + 1900, tm->tm_hour, tm->tm_min, tm->tm_sec);
+}
+
+/**
+ * @brief 生成ETag和200响应头中与连接无关的部分，缓存的文件只在第一次使用时生成一次。
+ *        ETag由修改时间和长度组成，文件变化后缓存会重新读入，两者至少有一个不同；变体的ETag带上编码名
+ *
+ * @param conn 提供type、encoding和vary
+ * @param file
+ * @return int 成功为0；放不下时为-1，此时file->head_len为0
+ */
+static int head_200(http_conn_t* conn, http_file_t* file) {
+    char date[32], encoding[48] = "";
+    http_date(date, file->mtime);
+    if (conn->encoding != HTTP_ENCODING_IDENTITY) {
+        snprintf(file->etag, sizeof(file->etag), "\"%llx-%zx-%s\"", (unsigned long long)file->mtime, file->size, encoding_name[conn->encoding]);
+        snprintf(encoding, sizeof(encoding), "Content-Encoding: %s\r\n", encoding_name[conn->encoding]);
+    } else {
+        snprintf(file->etag, sizeof(file->etag), "\"%llx-%zx\"", (unsigned long long)file->mtime, file->size);
     }
-    tcp_connect_t* tcp = fifo->buffer[fifo->tail];
-    fifo->tail++;
-    if (fifo->tail >= TCP_FIFO_SIZE) {
-        fifo->tail = 0;
+    file->head_encoding = conn->encoding;
+    int len = snprintf(file->head, sizeof(file->head),
+        "HTTP/1.1 200 OK\r\n"
+        "Server: " HTTP_SERVER_NAME "\r\n"
+        "Content-Type: %s\r\n"
+        "%s"
+        "Content-Length: %zu\r\n"
+        "Last-Modified: %s\r\n"
+        "ETag: %s\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "%s", conn->type, encoding, file->size, date, file->etag, conn->vary ? "Vary: Accept-Encoding\r\n" : "");
+    //还要给每次响应追加的Connection留出位置
+    if (len < 0 || (size_t)len + sizeof("Connection: keep-alive\r\n\r\n") > sizeof(file->head)) {
+        file->head_len = 0;
+        return -1;
     }
-    fifo->count--;
-    return tcp;
+    file->head_len = len;
+    return 0;
 }
 
-static size_t get_line(tcp_connect_t* tcp, char* buf, size_t size) {
-    size_t i = 0;
-    while (i < size) {
-        char c;
-        if (tcp_connect_read(tcp, (uint8_t*)&c, 1) > 0) {
-            if (c == '\n') {
-                break;
-            }
-            if (c != '\n' && c != '\r') {
-                buf[i] = c;
-                i++;
-            }
-        }
-        net_poll();
-    }
-    buf[i] = '\0';
-    return i;
+/**
+ * @brief 客户端缓存的副本是否仍然有效。有If-None-Match时只看它，否则看If-Modified-Since
+ *
+ * @param file
+ * @param req
+ * @param data 请求起点
+ * @return int 可以回复304时为1
+ */
+static int not_modified(http_file_t* file, const http_req_t* req, const uint8_t* data) {
+    const http_str_t* inm = http_req_header(req, data, "If-None-Match");
+    if (inm != NULL)
+        return http_etag_match(data, *inm, file->etag);
+    const http_str_t* ims = http_req_header(req, data, "If-Modified-Since");
+    time_t since;
+    return ims != NULL && http_parse_date(data, *ims, &since) == 0 && file->mtime <= since;
 }
 
-static size_t http_send(tcp_connect_t* tcp, const char* buf, size_t size) {
-    size_t send = 0;
-    while (send < size) {
-        send += tcp_connect_write(tcp, (const uint8_t*)buf + send, size - send);
-        net_poll();
-    }
-    return send;
+/**
+ * @brief If-Range条件是否成立，不成立时忽略Range发送整个文件。实体标签按强比较，时间必须和修改时间相同
+ *
+ * @param file
+ * @param req
+ * @param data 请求起点
+ * @return int 没有If-Range或者条件成立时为1
+ */
+static int if_range(http_file_t* file, const http_req_t* req, const uint8_t* data) {
+    const http_str_t* ir = http_req_header(req, data, "If-Range");
+    time_t t;
+    if (ir == NULL)
+        return 1;
+    if (ir->len > 0 && data[ir->off] == '"')
+        return http_str_eq(data, *ir, file->etag);
+    return http_parse_date(data, *ir, &t) == 0 && t == file->mtime;
 }
 
-static void close_http(tcp_connect_t* tcp) {
-    tcp_connect_close(tcp);
-    printf("http closed.\n");
+/**
+ * @brief snprintf的结果是否完整地放进了size字节的缓存
+ *
+ * @param len snprintf的返回值
+ * @param size 缓存大小
+ * @return int
+ */
+static inline int head_fits(int len, size_t size) {
+    return len >= 0 && (size_t)len < size;
+}
+
+/**
+ * @brief 生成多段响应中第i个区间之前的分隔行和首部，i等于区间数时生成结尾的分隔行
+ *
+ * @param conn
+ * @param i
+ * @param buf 至少HTTP_HEAD_LEN字节
+ * @return int 长度，放不下时为-1
+ */
+static int part_head(http_conn_t* conn, int i, char* buf) {
+    int len;
+    if (i == conn->range_count) {
+        len = snprintf(buf, HTTP_HEAD_LEN, "\r\n--%s--\r\n", http_boundary);
+    } else {
+        http_range_t* r = &conn->ranges[i];
+        len = snprintf(buf, HTTP_HEAD_LEN,
+            "\r\n--%s\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Range: bytes %zu-%zu/%zu\r\n"
+            "\r\n", http_boundary, conn->type, r->off, r->off + r->len - 1, conn->file->size);
+    }
+    return head_fits(len, HTTP_HEAD_LEN) ? len : -1;
 }
 
+/**
+ * @brief 为Range请求生成响应头。一个区间时回复206和Content-Range，多个区间时回复multipart/byteranges，
+ *        各区间的内容仍然是文件的zbuf切片，只从缓存或映射中取用到的部分
+ *
+ * @param conn ranges和range_count已经填好
+ * @param connection
+ * @return int 成功为0，响应头或者某一段的分隔行放不下时为-1
+ */
+static int head_206(http_conn_t* conn, const char* connection) {
+    http_file_t* file = conn->file;
+    char date[32], multipart_type[64], content_range[96] = "", encoding[48] = "";
+    const char* content_type = conn->type;
+    size_t len = 0;
+    http_date(date, file->mtime);
+    if (conn->encoding != HTTP_ENCODING_IDENTITY)
+        snprintf(encoding, sizeof(encoding), "Content-Encoding: %s\r\n", encoding_name[conn->encoding]);
 
+    if (conn->range_count == 1) {
+        http_range_t* r = &conn->ranges[0];
+        len = r->len;
+        snprintf(content_range, sizeof(content_range), "Content-Range: bytes %zu-%zu/%zu\r\n", r->off, r->off + r->len - 1, file->size);
+    } else {
+        //内容长度是各段分隔行和区间长度之和，分隔行只为计算长度生成一次，之后发送时不会再放不下
+        char part[HTTP_HEAD_LEN];
+        conn->multipart = 1;
+        for (int i = 0; i <= conn->range_count; i++) {
+            int n = part_head(conn, i, part);
+            if (n < 0)
+                return -1;
+            len += n + (i < conn->range_count ? conn->ranges[i].len : 0);
+        }
+        snprintf(multipart_type, sizeof(multipart_type), "multipart/byteranges; boundary=%s", http_boundary);
+        content_type = multipart_type;
+    }
+    int n = snprintf(conn->head, sizeof(conn->head),
+        "HTTP/1.1 206 Partial Content\r\n"
+        "Server: " HTTP_SERVER_NAME "\r\n"
+        "Content-Type: %s\r\n"
+        "%s"
+        "%s"
+        "Content-Length: %zu\r\n"
+        "Last-Modified: %s\r\n"
+        "ETag: %s\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "%s"
+        "Connection: %s\r\n"
+        "\r\n", content_type, content_range, encoding, len, date, file->etag, conn->vary ? "Vary: Accept-Encoding\r\n" : "", connection);
+    if (!head_fits(n, sizeof(conn->head)))
+        return -1;
+    conn->head_len = n;
+    return 0;
+}
 
-static void send_file(tcp_connect_t* tcp, const char* url) {
-    FILE* file;
-    char file_path[255];
-    char tx_buffer[1024];
+/**
+ * @brief 按请求的url找到文件并生成响应头，文件不存在时生成404，客户端的副本仍然有效时生成304，
+ *        有Range时生成206或416。文本类资源有客户端接受的预压缩变体时发送变体，条件请求和Range都针对变体。
+ *        小文件来自文件缓存，大文件被映射，两者的内容都不经过任何中间缓存直接交给tcp
+ *
+ * @param conn
+ * @param url 以0结尾的路径
+ * @param data 请求起点，用于读取条件请求的首部
+ * @return int 响应头已生成为0；文件或变体还在读入为1，conn->file持有它的引用并在等待；响应头放不下为-1
+ */
+static int open_file(http_conn_t* conn, const char* url, const uint8_t* data) {
+    char file_path[HTTP_PATH_LEN];
 
     //解析url路径
     memcpy(file_path, XHTTP_DOC_DIR, sizeof(XHTTP_DOC_DIR));
@@ -93,59 +322,316 @@ static void send_file(tcp_connect_t* tcp, const char* url) {
     }else{
         strcat(file_path, url);
     }
-    file = fopen(file_path, "rb");  //二进制方法打开文件
+    const char* connection = conn->keep_alive ? "keep-alive" : "close";
+    conn->head_off = 0;
+    conn->body_off = 0;
+    conn->range_idx = 0;
+    conn->multipart = 0;
+    conn->file = http_cache_get(file_path);
 
     //文件不存在发送404
-    if(file == NULL){
-
-        //填充http报头
-        sprintf(tx_buffer, "HTTP/1.0 404 NOT FOUND\r\n");
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
-        sprintf(tx_buffer, "Sever: \r\n");  //提供服务者缺省
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
-        sprintf(tx_buffer, "Content-Type: text/html\r\n");
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
-        sprintf(tx_buffer, "\r\n");
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
-        sprintf(tx_buffer, "<HTML><TITLE>Not Found</TITLE>\r\n");
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
-        sprintf(tx_buffer, "The resource specified\r\n");
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
-        sprintf(tx_buffer, "is unavailable or nonexistent.\r\n");
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
-        sprintf(tx_buffer, "</BODY></HTML>\r\n");
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
-    }
-    
-    //资源存在
-    else{
-        sprintf(tx_buffer, "HTTP/1.0 200 OK\r\n");
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
-        sprintf(tx_buffer, "Sever: \r\n");  //提供服务者缺省
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
-        sprintf(tx_buffer, "Content-Type: \r\n");  //由于需要传输text与jpg直接缺省
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
-        sprintf(tx_buffer, "\r\n");
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
-
-        //读取html以及jpg文件
-        memset(tx_buffer, 0, sizeof(tx_buffer));
-        while(fread(tx_buffer, sizeof(char), sizeof(tx_buffer), file) > 0){
-            http_send(tcp, tx_buffer, sizeof(tx_buffer));
-            memset(tx_buffer, 0, sizeof(tx_buffer));
+    if(conn->file == NULL){
+        static const char body[] =
+            "<HTML><TITLE>Not Found</TITLE>\r\n"
+            "The resource specified\r\n"
+            "is unavailable or nonexistent.\r\n"
+            "</BODY></HTML>\r\n";
+        int n = snprintf(conn->head, sizeof(conn->head),
+            "HTTP/1.1 404 Not Found\r\n"
+            "Server: " HTTP_SERVER_NAME "\r\n"
+            "Content-Type: text/html; charset=utf-8\r\n"
+            "Content-Length: %zu\r\n"
+            "Connection: %s\r\n"
+            "\r\n"
+            "%s", sizeof(body) - 1, connection, body);
+        if (!head_fits(n, sizeof(conn->head)))
+            return -1;
+        conn->head_len = n;
+        return 0;
+    }
+    if (conn->file->loading) {
+        http_cache_wait(conn->file, &conn->wait);
+        return 1;
+    }
+
+    //按Accept-Encoding在存在的变体中选择，变体是否存在已经由缓存记录，这里不做系统调用
+    http_file_t* file = conn->file;
+    const http_mime_t* mime = mime_type(file_path);
+    const http_str_t* accept = http_req_header(&conn->req, data, "Accept-Encoding");
+    conn->type = mime->type;
+    conn->vary = mime->compress;
+    conn->encoding = HTTP_ENCODING_IDENTITY;
+    for (int i = 0; mime->compress && accept != NULL && i < HTTP_ENCODING_IDENTITY; i++) {
+        if (!(file->variants & (1 << i)) || !http_accept_coding(data, *accept, encoding_name[i]))
+            continue;
+        http_file_t* variant = http_cache_get_variant(file, i);
+        if (variant != NULL) {
+            http_cache_put(file);
+            conn->file = file = variant;
+            conn->encoding = i;
+            if (file->loading) {
+                http_cache_wait(file, &conn->wait);
+                return 1;
+            }
+            break;
+        }
+    }
+
+    //资源存在，响应头只需要拷贝预先生成的部分再加上Connection，和文件开头一起组成第一个报文段
+    if((file->head_len == 0 || file->head_encoding != conn->encoding) && head_200(conn, file) != 0){
+        LOG(LOG_HTTP, LOG_WARN, "response head too long: %s", file_path);
+        http_cache_put(file);
+        conn->file = NULL;
+        return -1;
+    }
+
+    //条件请求命中时只回复几十字节的304，不发送内容
+    if(not_modified(file, &conn->req, data)){
+        int n = snprintf(conn->head, sizeof(conn->head),
+            "HTTP/1.1 304 Not Modified\r\n"
+            "Server: " HTTP_SERVER_NAME "\r\n"
+            "ETag: %s\r\n"
+            "%s"
+            "Connection: %s\r\n"
+            "\r\n", file->etag, conn->vary ? "Vary: Accept-Encoding\r\n" : "", connection);
+        http_cache_put(file);
+        conn->file = NULL;
+        if (!head_fits(n, sizeof(conn->head)))
+            return -1;
+        conn->head_len = n;
+        return 0;
+    }
+
+    //Range语法错误或者If-Range不成立时按普通请求处理
+    const http_str_t* range = http_req_header(&conn->req, data, "Range");
+    int n = -1;
+    if (range != NULL && if_range(file, &conn->req, data))
+        n = http_parse_range(data, *range, file->size, conn->ranges, HTTP_MAX_RANGES);
+    if (n == 0) {
+        n = snprintf(conn->head, sizeof(conn->head),
+            "HTTP/1.1 416 Range Not Satisfiable\r\n"
+            "Server: " HTTP_SERVER_NAME "\r\n"
+            "Content-Range: bytes */%zu\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: %s\r\n"
+            "\r\n", file->size, connection);
+        http_cache_put(file);
+        conn->file = NULL;
+        if (!head_fits(n, sizeof(conn->head)))
+            return -1;
+        conn->head_len = n;
+        return 0;
+    }
+    if (n > 0) {
+        conn->range_count = n;
+        if (head_206(conn, connection) != 0) {
+            LOG(LOG_HTTP, LOG_WARN, "response head too long: %s", file_path);
+            http_cache_put(file);
+            conn->file = NULL;
+            return -1;
+        }
+        return 0;
+    }
+
+    //head_200已经留出了Connection的位置，这里仍然按剩余空间检查
+    conn->ranges[0] = (http_range_t){0, file->size};
+    conn->range_count = 1;
+    memcpy(conn->head, file->head, file->head_len);
+    n = snprintf(conn->head + file->head_len, sizeof(conn->head) - file->head_len, "Connection: %s\r\n\r\n", connection);
+    if (!head_fits(n, sizeof(conn->head) - file->head_len)) {
+        http_cache_put(file);
+        conn->file = NULL;
+        return -1;
+    }
+    conn->head_len = file->head_len + n;
+    return 0;
+}
+
+/**
+ * @brief 请求头完整后检查请求，准备响应并消费请求头。
+ *        文件还在读入时不消费，读完后用接收缓存里的同一个请求重新调用
+ *
+ * @param conn
+ * @param data 请求起点
+ * @return int 成功为0，等待文件读入为1，不支持的请求或者响应头放不下为-1
+ */
+static int start_response(http_conn_t* conn, const uint8_t* data) {
+    http_req_t* req = &conn->req;
+    char url_path[HTTP_PATH_LEN];
+
+    //判断是否是GET请求
+    if (!http_str_eq(data, req->method, "GET") || req->path.len + sizeof(XHTTP_DOC_DIR) > sizeof(url_path))
+        return -1;
+
+    //路径要交给fopen，拷贝出来并补上结尾的0
+    memcpy(url_path, data + req->path.off, req->path.len);
+    url_path[req->path.len] = '\0';
+
+    //HTTP/1.1默认保持连接，HTTP/1.0需要显式请求；达到单连接请求数上限后关闭
+    const http_str_t* connection = http_req_header(req, data, "Connection");
+    if (http_str_eq(data, req->version, "HTTP/1.1"))
+        conn->keep_alive = connection == NULL || !http_str_case_eq(data, *connection, "close");
+    else
+        conn->keep_alive = connection != NULL && http_str_case_eq(data, *connection, "keep-alive");
+    if (conn->requests >= HTTP_KEEPALIVE_MAX)
+        conn->keep_alive = 0;
+
+    int ret = open_file(conn, url_path, data);
+    if (ret != 0)
+        return ret;
+
+    //请求头到此为止，流水线上的下一个请求留在接收缓存里
+    tcp_connect_consume(conn->tcp, req->len);
+    return 0;
+}
+
+/**
+ * @brief 尽可能推进一个连接，写不下时返回，等TCP_CONN_DATA_SENT再继续。
+ *        保持连接时一个响应写完后继续处理接收缓存中流水线发来的下一个请求，按到达顺序逐个响应
+ *
+ * @param conn
+ */
+static void http_advance(http_conn_t* conn) {
+    tcp_connect_t* tcp = conn->tcp;
+    const uint8_t* data;
+    size_t len;
+
+    for (;;) {
+        switch (conn->state) {
+        case HTTP_READ_REQUEST:
+            len = tcp_connect_peek(tcp, &data);
+            switch (http_req_parse(&conn->req, data, len)) {
+            case HTTP_PARSE_AGAIN:
+                //没有完整的请求可以处理了，把攒着的响应发出去，等待下一个请求
+                if (tcp->cork)
+                    tcp_connect_setopt(tcp, TCP_CONN_CORK, 0);
+                //对端已经关闭，不会再有请求，发完响应后关闭
+                if (tcp->state == TCP_CLOSE_WAIT) {
+                    close_http(conn);
+                    return;
+                }
+                if (!timer_pending(&conn->idle_timer))
+                    timer_add(&http_timers, &conn->idle_timer, time_ms() + HTTP_KEEPALIVE_MS);
+                return;
+            case HTTP_PARSE_ERROR:
+                close_http(conn);
+                return;
+            case HTTP_PARSE_DONE:
+                break;
+            }
+            timer_del(&http_timers, &conn->idle_timer);
+            conn->requests++;
+            conn->state = HTTP_OPEN_FILE;
+            // fall through
+
+        case HTTP_OPEN_FILE:
+            //等待读入时到达的数据留在接收缓存里，读完后再处理
+            if (conn->file != NULL)
+                return;
+            tcp_connect_peek(tcp, &data);
+            switch (start_response(conn, data)) {
+            case 1:
+                //流水线上前面的响应不必等这个文件
+                if (tcp->cork)
+                    tcp_connect_setopt(tcp, TCP_CONN_CORK, 0);
+                return;
+            case -1:
+                close_http(conn);
+                return;
+            }
+
+            //响应头和文件内容分几次写入，cork把它们以及流水线上后续的响应合并成满段，没有请求可处理时再取消
+            if (!tcp->cork)
+                tcp_connect_setopt(tcp, TCP_CONN_CORK, 1);
+            conn->state = HTTP_SEND_HEADER;
+            // fall through
+
+        case HTTP_SEND_HEADER:
+            conn->head_off += tcp_connect_write(tcp, (const uint8_t*)conn->head + conn->head_off, conn->head_len - conn->head_off);
+            if (conn->head_off < conn->head_len)
+                return;
+            conn->state = HTTP_SEND_BODY;
+            //分隔行在head_206中都生成过一次，不会放不下
+            if (conn->multipart) {
+                conn->head_len = part_head(conn, 0, conn->head);
+                conn->head_off = 0;
+            }
+            // fall through
+
+        case HTTP_SEND_BODY:
+            //文件的各个区间按段作为zbuf交给tcp，报文段直接引用缓存或映射的页面，发送队列满时等待TCP_CONN_DATA_SENT
+            while (conn->file != NULL) {
+                //多段响应在区间之间写分隔行
+                if (conn->head_off < conn->head_len) {
+                    conn->head_off += tcp_connect_write(tcp, (const uint8_t*)conn->head + conn->head_off, conn->head_len - conn->head_off);
+                    if (conn->head_off < conn->head_len)
+                        return;
+                }
+                if (conn->range_idx == conn->range_count)
+                    break;
+
+                http_range_t* r = &conn->ranges[conn->range_idx];
+                while (conn->body_off < r->len) {
+                    size_t n = r->len - conn->body_off;
+                    if (n > HTTP_ZBUF_MAX)
+                        n = HTTP_ZBUF_MAX;
+                    if (tcp_connect_write_zbuf(tcp, &conn->file->zbuf, r->off + conn->body_off, n) != 0)
+                        return;
+                    conn->body_off += n;
+                }
+                conn->range_idx++;
+                conn->body_off = 0;
+                if (conn->multipart) {
+                    conn->head_len = part_head(conn, conn->range_idx, conn->head);
+                    conn->head_off = 0;
+                }
+            }
+            conn->state = HTTP_DONE;
+            // fall through
+
+        case HTTP_DONE:
+            if (conn->file != NULL) {
+                http_cache_put(conn->file);
+                conn->file = NULL;
+            }
+
+            //不保持连接时关闭tcp链接，剩余数据由tcp发完后再发送fin
+            if (!conn->keep_alive) {
+                tcp_connect_setopt(tcp, TCP_CONN_CORK, 0);
+                close_http(conn);
+                return;
+            }
+            http_req_init(&conn->req);
+            conn->state = HTTP_READ_REQUEST;
+            break;
         }
-        fclose(file);
     }
+}
 
+/**
+ * @brief 文件读入完成或失败，放下等待的引用，重新处理同一个请求，这时文件已经在缓存中
+ *
+ * @param wait
+ */
+static void http_file_ready(http_wait_t* wait) {
+    http_conn_t* conn = http_wait_entry(wait, http_conn_t, wait);
+    http_cache_put(conn->file);
+    conn->file = NULL;
+    http_advance(conn);
 }
 
 static void http_handler(tcp_connect_t* tcp, connect_state_t state) {
-    if (state == TCP_CONN_CONNECTED) {
-        http_fifo_in(&http_fifo_v, tcp);
-        printf("http conntected.\n");
-    } else if (state == TCP_CONN_DATA_RECV) {
+    http_conn_t* conn = tcp->arg;
+
+    //还在accept队列中的连接没有http状态，取出时再处理已收到的数据
+    if (conn == NULL)
+        return;
+    if (state == TCP_CONN_DATA_RECV || state == TCP_CONN_DATA_SENT) {
+        http_advance(conn);
     } else if (state == TCP_CONN_CLOSED) {
-        printf("http closed.\n");
+        //tcp连接已经由协议栈释放，只回收http状态
+        LOG(LOG_HTTP, LOG_DEBUG, "closed by peer %s:%u", iptos(tcp->ip), tcp->remote_port);
+        free_http(conn);
     } else {
         assert(0);
     }
@@ -154,58 +640,46 @@ static void http_handler(tcp_connect_t* tcp, connect_state_t state) {
 
 // 在端口上创建服务器。
 int http_server_open(uint16_t port) {
-    if (!tcp_open(port, http_handler)) {
+    if (pool_init(&http_pool, sizeof(http_conn_t), TCP_MAX_CONNECT) != 0) {
+        return -1;
+    }
+    timer_wheel_init(&http_timers, time_ms());
+    http_cache_init();
+    uint8_t seed[8];
+    random_bytes(seed, sizeof(seed));
+    for (int i = 0; i < 8; i++)
+        sprintf(http_boundary + 2 * i, "%02x", seed[i]);
+    if (tcp_listen(port, HTTP_BACKLOG, http_handler) != 0) {
         return -1;
     }
-    http_fifo_init(&http_fifo_v);
+    http_port = port;
     return 0;
 }
 
-// 从FIFO取出请求并处理。新的HTTP请求时会发送到FIFO中等待处理。
+// 从accept队列取出新连接，为每个连接建立状态后交给事件推进，本身不等待任何连接。
 void http_server_run(void) {
     tcp_connect_t* tcp;
-    char url_path[255];
-    char rx_buffer[1024];
 
-    while ((tcp = http_fifo_out(&http_fifo_v)) != NULL) {
-        int i;
-        char* c = rx_buffer;
-
-        //调用get_line获取请求报文的方法
-        size_t size = get_line(tcp, c, 1023);
-        if(size == 0){
-            close_http(tcp);
-            continue;
-        }
+    timer_wheel_run(&http_timers, time_ms());
 
-        //判断是否是GET请求
-        char method[4];
-        memcpy(method, c, 3);
-        if(strcmp(method, "GET")){
-            close_http(tcp);
+    while ((tcp = tcp_accept(http_port)) != NULL) {
+        http_conn_t* conn = pool_alloc(&http_pool);
+        if (conn == NULL) {
+            tcp_connect_close(tcp);
             continue;
         }
+        LOG(LOG_HTTP, LOG_DEBUG, "connected %s:%u", iptos(tcp->ip), tcp->remote_port);
+        conn->tcp = tcp;
+        conn->state = HTTP_READ_REQUEST;
+        conn->file = NULL;
+        conn->keep_alive = 0;
+        conn->requests = 0;
+        timer_node_init(&conn->idle_timer, http_idle_timer);
+        conn->wait.fn = http_file_ready;
+        http_req_init(&conn->req);
+        tcp->arg = conn;
 
-        //解析路径
-        i = 0;
-        int j = 0;
-        while(c[i] != ' '){
-            i++;
-        }
-        i++; //跳过空格
-        while(c[i] != ' '){
-            url_path[j] = c[i];
-            j++;
-            i++;
-        }
-        url_path[j] = '\0';
-
-        send_file(tcp, url_path);
-
-        //一次http传输结束关闭tcp链接
-        close_http(tcp);
-
-
-        printf("!! final close\n");
+        //请求可能在排队时就已经到达
+        http_advance(conn);
     }
 }
@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+#include "http_cache.h"
+#include "utils.h"
+#include "log.h"
+
+static http_file_t *cache_table[HTTP_CACHE_HASH_SIZE]; //按路径哈希的文件表
+static http_file_t *lru_head, *lru_tail;               //LRU链表的两端，从尾部开始淘汰
+static size_t cache_bytes;                             //缓存中文件内容的总字节数，不含已淘汰但仍在发送的文件
+static size_t mapped_count;                            //表中映射的大文件数
+static const char *variant_suffix[] = {".br", ".gz"};  //按http_encoding_t排列
+
+/**
+ * @brief 路径的FNV-1a哈希
+ *
+ * @param path
+ * @return uint32_t 桶下标
+ */
+static uint32_t http_cache_hash(const char *path)
+{
+    uint32_t h = 2166136261u;
+    while (*path)
+        h = (h ^ (uint8_t)*path++) * 16777619u;
+    return h & (HTTP_CACHE_HASH_SIZE - 1);
+}
+
+static void lru_unlink(http_file_t *file)
+{
+    if (file->lru_prev)
+        file->lru_prev->lru_next = file->lru_next;
+    else
+        lru_head = file->lru_next;
+    if (file->lru_next)
+        file->lru_next->lru_prev = file->lru_prev;
+    else
+        lru_tail = file->lru_prev;
+}
+
+static void lru_push_front(http_file_t *file)
+{
+    file->lru_prev = NULL;
+    file->lru_next = lru_head;
+    if (lru_head)
+        lru_head->lru_prev = file;
+    else
+        lru_tail = file;
+    lru_head = file;
+}
+
+/**
+ * @brief LRU链表中最久没有使用的读入缓存的文件或者映射的文件
+ *
+ * @param mapped
+ * @return http_file_t* 没有时为NULL
+ */
+static http_file_t *lru_last(int mapped)
+{
+    http_file_t *file = lru_tail;
+    while (file && file->mapped != mapped)
+        file = file->lru_prev;
+    return file;
+}
+
+/**
+ * @brief 检查文件有哪些预压缩变体，和文件的修改时间一起检查，请求时不再stat。
+ *        文件本身就是变体时不检查，不会有变体的变体
+ *
+ * @param file
+ */
+static void http_file_variants(http_file_t *file)
+{
+    char path[HTTP_PATH_LEN];
+    struct stat st;
+    size_t len = strlen(file->path);
+    file->variants = 0;
+    for (int i = 0; i < HTTP_ENCODING_IDENTITY; i++)
+    {
+        size_t n = strlen(variant_suffix[i]);
+        if (len >= n && strcmp(file->path + len - n, variant_suffix[i]) == 0)
+            return;
+    }
+    for (int i = 0; i < HTTP_ENCODING_IDENTITY; i++)
+    {
+        //加上后缀超长的变体不能被缓存，当作没有
+        if (snprintf(path, sizeof(path), "%s%s", file->path, variant_suffix[i]) >= (int)sizeof(path))
+            continue;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            file->variants |= 1 << i;
+    }
+}
+
+/**
+ * @brief 文件的最后一个引用被释放，回收内存
+ *
+ * @param zbuf
+ */
+static void http_file_free(tcp_zbuf_t *zbuf)
+{
+    free(zbuf->arg);
+}
+
+/**
+ * @brief 只读映射整个文件
+ *
+ * @param path
+ * @param size 文件长度，不能为0
+ * @return void* 映射的起始地址，失败为NULL
+ */
+static void *http_map(const char *path, size_t size)
+{
+#ifdef _WIN32
+    HANDLE fh = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (fh == INVALID_HANDLE_VALUE)
+        return NULL;
+    HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(fh);
+    if (mh == NULL)
+        return NULL;
+    void *p = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, size);
+    CloseHandle(mh);
+    return p;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+    madvise(p, size, MADV_SEQUENTIAL);
+    return p;
+#endif
+}
+
+/**
+ * @brief 映射的文件不再被任何连接使用，解除映射
+ *
+ * @param zbuf
+ */
+static void http_file_unmap(tcp_zbuf_t *zbuf)
+{
+#ifdef _WIN32
+    UnmapViewOfFile((void *)zbuf->data);
+#else
+    munmap((void *)zbuf->data, zbuf->len);
+#endif
+    free(zbuf->arg);
+}
+
+/**
+ * @brief 把文件放进哈希表和LRU链表头部
+ *
+ * @param file
+ */
+static void http_cache_insert(http_file_t *file)
+{
+    uint32_t h = http_cache_hash(file->path);
+    file->hash_next = cache_table[h];
+    cache_table[h] = file;
+    lru_push_front(file);
+}
+
+/**
+ * @brief 把文件移出缓存，正在发送它的连接仍然持有引用，发完后才真正释放
+ *
+ * @param file
+ */
+static void http_cache_evict(http_file_t *file)
+{
+    http_file_t **pp = &cache_table[http_cache_hash(file->path)];
+    while (*pp != file)
+        pp = &(*pp)->hash_next;
+    *pp = file->hash_next;
+    lru_unlink(file);
+    if (file->mapped)
+        mapped_count--;
+    else
+        cache_bytes -= file->size;
+    tcp_zbuf_put(&file->zbuf);
+}
+
+/**
+ * @brief 为不读入缓存的大文件建立映射，tcp直接从映射的页面组装报文段，不经过任何中间缓存。
+ *        映射连同变体的检查结果留在表中，和缓存的文件一样按HTTP_CACHE_CHECK_MS确认，命中时不做系统调用；
+ *        映射数超过HTTP_CACHE_MAX_MAPPED时先解除最久没有使用的映射
+ *
+ * @param path
+ * @param st 文件的stat结果
+ * @return http_file_t* 表持有一个引用，被淘汰并且最后一个引用释放时解除映射；失败为NULL
+ */
+static http_file_t *http_file_map(const char *path, const struct stat *st)
+{
+    size_t size = st->st_size;
+    http_file_t *file = malloc(sizeof(http_file_t));
+    if (file == NULL)
+        return NULL;
+    void *data = http_map(path, size);
+    if (data == NULL)
+    {
+        free(file);
+        return NULL;
+    }
+    if (mapped_count >= HTTP_CACHE_MAX_MAPPED)
+        http_cache_evict(lru_last(1));
+
+    strcpy(file->path, path);
+    file->size = size;
+    file->mtime = st->st_mtime;
+    file->checked = time_ms();
+    file->head_len = 0;
+    file->loading = file->failed = 0;
+    file->mapped = 1;
+    file->waiters = NULL;
+    http_file_variants(file);
+    tcp_zbuf_init(&file->zbuf, data, size, http_file_unmap, file);
+    http_cache_insert(file);
+    mapped_count++;
+    return file;
+}
+
+/**
+ * @brief 文件内容读入完成，唤醒等待的连接
+ *        失败的文件留在缓存中，到下次检查前的请求都当作文件不存在，不会反复读
+ *
+ * @param req
+ */
+static void http_cache_loaded(aio_req_t *req)
+{
+    http_file_t *file = aio_entry(req, http_file_t, aio);
+    close(req->fd);
+    file->loading = 0;
+    if (req->err != 0 || req->done != file->size)
+    {
+        file->failed = 1;
+        LOG(LOG_HTTP, LOG_WARN, "cache load %s failed: %s", file->path, req->err ? strerror(req->err) : "short read");
+    }
+
+    //回调可能关闭连接或者再次请求这个文件，先把等待链表取下来
+    http_wait_t *wait = file->waiters;
+    file->waiters = NULL;
+    while (wait)
+    {
+        http_wait_t *next = wait->next;
+        wait->fn(wait);
+        wait = next;
+    }
+    tcp_zbuf_put(&file->zbuf);
+}
+
+/**
+ * @brief 把文件放进缓存并提交异步读，超出预算时先从LRU尾部淘汰。
+ *        读入完成前文件已经在哈希表中，同一文件的其他请求一起等待这一次读入，不会阻塞主循环
+ *
+ * @param path
+ * @param st 文件的stat结果
+ * @return http_file_t* loading为1，读入完成前不能使用内容；失败为NULL
+ */
+static http_file_t *http_cache_load(const char *path, const struct stat *st)
+{
+    size_t size = st->st_size;
+    http_file_t *file = malloc(sizeof(http_file_t) + size);
+    if (file == NULL)
+        return NULL;
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0)
+    {
+        free(file);
+        return NULL;
+    }
+
+    //只有读入的文件占用预算，映射的文件不因此被淘汰
+    http_file_t *victim;
+    while (cache_bytes + size > HTTP_CACHE_BYTES && (victim = lru_last(0)) != NULL)
+        http_cache_evict(victim);
+
+    strcpy(file->path, path);
+    file->size = size;
+    file->mtime = st->st_mtime;
+    file->checked = time_ms();
+    file->head_len = 0;
+    file->loading = 1;
+    file->failed = 0;
+    file->mapped = 0;
+    file->waiters = NULL;
+    http_file_variants(file);
+    tcp_zbuf_init(&file->zbuf, file->data, size, http_file_free, file);
+    http_cache_insert(file);
+    cache_bytes += size;
+    LOG(LOG_HTTP, LOG_DEBUG, "cache load %s (%zu bytes, %zu cached)", path, size, cache_bytes);
+
+    //读请求持有一个引用，文件在读入期间被淘汰、等待的连接都关闭时内存也不会被释放
+    tcp_zbuf_get(&file->zbuf);
+    aio_read(&file->aio, fd, file->data, size, 0, http_cache_loaded);
+    return file;
+}
+
+/**
+ * @brief 初始化文件缓存
+ *
+ */
+void http_cache_init()
+{
+    memset(cache_table, 0, sizeof(cache_table));
+    lru_head = lru_tail = NULL;
+    cache_bytes = 0;
+    mapped_count = 0;
+    aio_init();
+}
+
+/**
+ * @brief 取得一个文件的缓存，没有时提交异步读入。
+ *        命中时只在距上次确认超过HTTP_CACHE_CHECK_MS后才stat一次，修改时间或长度变了、上次读入失败就重新读入，
+ *        其余请求不做任何系统调用。
+ *        超过HTTP_CACHE_MAX_FILE的文件不读入而是映射，映射同样留在表中，命中时不再映射和检查变体
+ *
+ * @param path 打开文件用的完整路径
+ * @return http_file_t* 带有一个引用，用完后调用http_cache_put；loading为1时要先用http_cache_wait等待读入完成。
+ *         文件不存在、不是普通文件、读入失败或者映射失败时为NULL
+ */
+http_file_t *http_cache_get(const char *path)
+{
+    struct stat st;
+    uint64_t now = time_ms();
+    if (strlen(path) >= HTTP_PATH_LEN)
+        return NULL;
+
+    http_file_t *file = cache_table[http_cache_hash(path)];
+    while (file && strcmp(file->path, path) != 0)
+        file = file->hash_next;
+
+    if (file && file->failed && now - file->checked < HTTP_CACHE_CHECK_MS)
+        return NULL;
+    if (file && now - file->checked >= HTTP_CACHE_CHECK_MS)
+    {
+        if (stat(path, &st) != 0)
+        {
+            http_cache_evict(file);
+            return NULL;
+        }
+        if (file->failed || st.st_mtime != file->mtime || (size_t)st.st_size != file->size)
+        {
+            http_cache_evict(file);
+            file = NULL;
+        }
+        else
+        {
+            file->checked = now;
+            http_file_variants(file);
+        }
+    }
+    else if (file == NULL && stat(path, &st) != 0)
+    {
+        return NULL;
+    }
+
+    if (file)
+    {
+        lru_unlink(file);
+        lru_push_front(file);
+    }
+    else
+    {
+        if (!S_ISREG(st.st_mode))
+            return NULL;
+        if (st.st_size > HTTP_CACHE_MAX_FILE)
+            file = st.st_size <= UINT32_MAX ? http_file_map(path, &st) : NULL;
+        else
+            file = http_cache_load(path, &st);
+        if (file == NULL)
+            return NULL;
+    }
+    tcp_zbuf_get(&file->zbuf);
+    return file;
+}
+
+/**
+ * @brief 取得文件的一个预压缩变体，变体本身和其他文件一样被缓存或映射
+ *
+ * @param file 原文件，variants中有这个变体
+ * @param encoding
+ * @return http_file_t* 带有一个引用，变体已被删除时为NULL
+ */
+http_file_t *http_cache_get_variant(const http_file_t *file, http_encoding_t encoding)
+{
+    char path[HTTP_PATH_LEN];
+    if (snprintf(path, sizeof(path), "%s%s", file->path, variant_suffix[encoding]) >= (int)sizeof(path))
+        return NULL;
+    return http_cache_get(path);
+}
+
+/**
+ * @brief 等待正在读入的文件，读入完成或失败时调用wait->fn，调用前wait已经从等待链表中取下
+ *
+ * @param file loading为1，调用者持有引用
+ * @param wait
+ */
+void http_cache_wait(http_file_t *file, http_wait_t *wait)
+{
+    wait->next = file->waiters;
+    file->waiters = wait;
+}
+
+/**
+ * @brief 放弃等待，连接在文件读入完成前关闭时调用；已经被取下的wait不做任何事
+ *
+ * @param file
+ * @param wait
+ */
+void http_cache_cancel(http_file_t *file, http_wait_t *wait)
+{
+    http_wait_t **pp = &file->waiters;
+    while (*pp && *pp != wait)
+        pp = &(*pp)->next;
+    if (*pp)
+        *pp = wait->next;
+}
+
+/**
+ * @brief 释放http_cache_get取得的引用
+ *
+ * @param file
+ */
+void http_cache_put(http_file_t *file)
+{
+    tcp_zbuf_put(&file->zbuf);
+}
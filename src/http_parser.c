@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "http_parser.h"
+
+/**
+ * @brief 初始化解析状态，开始解析一个新的请求
+ *
+ * @param req
+ */
+void http_req_init(http_req_t *req)
+{
+    memset(req, 0, sizeof(http_req_t));
+}
+
+/**
+ * @brief 去掉[*begin, *end)首尾的空格和制表符
+ *
+ * @param data
+ * @param begin
+ * @param end
+ */
+static void http_trim(const uint8_t *data, size_t *begin, size_t *end)
+{
+    while (*begin < *end && (data[*begin] == ' ' || data[*begin] == '\t'))
+        (*begin)++;
+    while (*end > *begin && (data[*end - 1] == ' ' || data[*end - 1] == '\t'))
+        (*end)--;
+}
+
+/**
+ * @brief 解析请求行 "METHOD SP target SP version"
+ *
+ * @param req
+ * @param data
+ * @param begin 行首
+ * @param end 行尾，不含CRLF
+ * @return int 成功为0，格式错误为-1
+ */
+static int http_parse_request_line(http_req_t *req, const uint8_t *data, size_t begin, size_t end)
+{
+    const uint8_t *sp1 = memchr(data + begin, ' ', end - begin);
+    if (sp1 == NULL || sp1 == data + begin)
+        return -1;
+    size_t target = sp1 - data + 1;
+    const uint8_t *sp2 = memchr(data + target, ' ', end - target);
+    if (sp2 == NULL || sp2 == data + target)
+        return -1;
+    size_t version = sp2 - data + 1;
+    if (version == end || memchr(data + version, ' ', end - version) != NULL)
+        return -1;
+
+    req->method = (http_str_t){begin, sp1 - data - begin};
+    req->path = (http_str_t){target, sp2 - data - target};
+    req->version = (http_str_t){version, end - version};
+    return 0;
+}
+
+/**
+ * @brief 解析一行首部 "name: value"
+ *
+ * @param req
+ * @param data
+ * @param begin 行首
+ * @param end 行尾，不含CRLF
+ * @return int 成功为0，格式错误为-1
+ */
+static int http_parse_header(http_req_t *req, const uint8_t *data, size_t begin, size_t end)
+{
+    const uint8_t *colon = memchr(data + begin, ':', end - begin);
+    if (colon == NULL || colon == data + begin)
+        return -1;
+    size_t name_end = colon - data;
+    //首部名和冒号之间不允许有空白
+    if (data[name_end - 1] == ' ' || data[name_end - 1] == '\t')
+        return -1;
+    if (req->header_count == HTTP_MAX_HEADERS)
+        return 0;
+
+    size_t value = name_end + 1;
+    http_trim(data, &value, &end);
+    http_header_t *header = &req->headers[req->header_count++];
+    header->name = (http_str_t){begin, name_end - begin};
+    header->value = (http_str_t){value, end - value};
+    return 0;
+}
+
+/**
+ * @brief 增量解析请求头
+ *        data是从请求起点开始、目前已收到的全部数据，可以直接传tcp_connect_peek的视图。
+ *        每次调用只检查上次之后新到的字节，返回HTTP_PARSE_AGAIN时不要消费这部分数据，
+ *        收到更多数据后用同一个req再次调用即可；data的地址可以变化，结果都以偏移记录。
+ *
+ * @param req
+ * @param data 请求起点
+ * @param len 已收到的字节数
+ * @return http_parse_status_t
+ */
+http_parse_status_t http_req_parse(http_req_t *req, const uint8_t *data, size_t len)
+{
+    while (req->scanned < len)
+    {
+        const uint8_t *nl = memchr(data + req->scanned, '\n', len - req->scanned);
+        if (nl == NULL)
+        {
+            req->scanned = len;
+            break;
+        }
+
+        size_t begin = req->line;
+        size_t end = nl - data;
+        req->scanned = req->line = end + 1;
+        if (end > begin && data[end - 1] == '\r')
+            end--;
+
+        if (!req->has_line)
+        {
+            //请求行之前的空行直接跳过
+            if (end == begin)
+            {
+                req->start = req->line;
+                continue;
+            }
+            if (http_parse_request_line(req, data, begin, end) != 0)
+                return HTTP_PARSE_ERROR;
+            req->has_line = 1;
+        }
+        else if (end == begin)
+        {
+            //一次收到的完整请求和分几次收到时一样受长度限制
+            if (req->line - req->start > HTTP_MAX_REQUEST_LEN)
+                return HTTP_PARSE_ERROR;
+            req->len = req->line;
+            return HTTP_PARSE_DONE;
+        }
+        else if (http_parse_header(req, data, begin, end) != 0)
+        {
+            return HTTP_PARSE_ERROR;
+        }
+    }
+
+    if (len - req->start >= HTTP_MAX_REQUEST_LEN)
+        return HTTP_PARSE_ERROR;
+    return HTTP_PARSE_AGAIN;
+}
+
+/**
+ * @brief 比较视图和字符串，区分大小写
+ *
+ * @param data 解析时的请求起点
+ * @param str
+ * @param s
+ * @return int 相等为1
+ */
+int http_str_eq(const uint8_t *data, http_str_t str, const char *s)
+{
+    return strlen(s) == str.len && memcmp(data + str.off, s, str.len) == 0;
+}
+
+/**
+ * @brief 比较视图和字符串，不区分大小写，用于首部名和大部分首部值
+ *
+ * @param data 解析时的请求起点
+ * @param str
+ * @param s
+ * @return int 相等为1
+ */
+int http_str_case_eq(const uint8_t *data, http_str_t str, const char *s)
+{
+    if (strlen(s) != str.len)
+        return 0;
+    for (size_t i = 0; i < str.len; i++)
+    {
+        if (tolower(data[str.off + i]) != tolower((uint8_t)s[i]))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief 按名字查找首部，不区分大小写，有重复时返回第一个
+ *
+ * @param req 已经解析完成的请求
+ * @param data 解析时的请求起点
+ * @param name
+ * @return const http_str_t* 首部的值，没有该首部时为NULL
+ */
+const http_str_t *http_req_header(const http_req_t *req, const uint8_t *data, const char *name)
+{
+    for (size_t i = 0; i < req->header_count; i++)
+    {
+        if (http_str_case_eq(data, req->headers[i].name, name))
+            return &req->headers[i].value;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 公历日期到1970-01-01的天数
+ *
+ * @param y 年
+ * @param m 月，1-12
+ * @param d 日
+ * @return long
+ */
+static long http_days_from_civil(long y, int m, int d)
+{
+    y -= m <= 2;
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/**
+ * @brief 解析固定位置上的n位十进制数字
+ *
+ * @param s
+ * @param n
+ * @return int 有非数字字符时为-1
+ */
+static int http_fixed_digits(const char *s, int n)
+{
+    int v = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (s[i] < '0' || s[i] > '9')
+            return -1;
+        v = v * 10 + (s[i] - '0');
+    }
+    return v;
+}
+
+/**
+ * @brief 解析IMF-fixdate格式的时间，如"Sun, 06 Nov 1994 08:49:37 GMT"
+ *        各字段位置固定，逐个检查分隔符和数字；不依赖timegm和locale；RFC 850和asctime这两种过时格式视为无法解析
+ *
+ * @param data 解析时的请求起点
+ * @param str
+ * @param t 解析结果
+ * @return int 成功为0，格式不对为-1
+ */
+int http_parse_date(const uint8_t *data, http_str_t str, time_t *t)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    const char *s = (const char *)data + str.off;
+    int mon;
+    if (str.len != 29 || s[3] != ',' || s[4] != ' ' || s[7] != ' ' || s[11] != ' ' || s[16] != ' ' ||
+        s[19] != ':' || s[22] != ':' || memcmp(s + 25, " GMT", 4) != 0)
+        return -1;
+    for (mon = 0; mon < 12 && memcmp(s + 8, months + mon * 3, 3) != 0; mon++)
+        ;
+    int d = http_fixed_digits(s + 5, 2);
+    int y = http_fixed_digits(s + 12, 4);
+    int hh = http_fixed_digits(s + 17, 2);
+    int mm = http_fixed_digits(s + 20, 2);
+    int ss = http_fixed_digits(s + 23, 2);
+    if (mon == 12 || y < 0 || d < 1 || d > 31 || hh < 0 || hh > 23 || mm < 0 || mm > 59 || ss < 0 || ss > 60)
+        return -1;
+    *t = (time_t)http_days_from_civil(y, mon + 1, d) * 86400 + hh * 3600 + mm * 60 + ss;
+    return 0;
+}
+
+/**
+ * @brief If-None-Match中的实体标签列表是否包含etag，按弱比较忽略W/前缀，"*"匹配任何标签。
+ *        标签按引号划分，引号内的逗号不分隔列表；没有引号的项不是合法标签，不匹配
+ *
+ * @param data 解析时的请求起点
+ * @param list 首部的值
+ * @param etag 带引号的标签
+ * @return int 匹配为1
+ */
+int http_etag_match(const uint8_t *data, http_str_t list, const char *etag)
+{
+    const char *p = (const char *)data + list.off;
+    const char *end = p + list.len;
+    size_t n = strlen(etag);
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        if (p == end)
+            break;
+        if (*p == '*')
+            return 1;
+        if (end - p >= 2 && p[0] == 'W' && p[1] == '/')
+            p += 2;
+        const char *q = NULL;
+        if (p < end && *p == '"')
+            q = memchr(p + 1, '"', end - p - 1);
+        if (q != NULL)
+        {
+            q++;
+            if ((size_t)(q - p) == n && memcmp(p, etag, n) == 0)
+                return 1;
+            p = q;
+        }
+        q = memchr(p, ',', end - p);
+        p = q == NULL ? end : q;
+    }
+    return 0;
+}
+
+/**
+ * @brief Accept-Encoding是否接受某种内容编码。只区分q=0和非0，没有列出时看"*"
+ *
+ * @param data 解析时的请求起点
+ * @param list 首部的值
+ * @param coding 编码名，如"gzip"
+ * @return int 接受为1
+ */
+int http_accept_coding(const uint8_t *data, http_str_t list, const char *coding)
+{
+    const char *p = (const char *)data + list.off;
+    const char *end = p + list.len;
+    int star = 0;
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        if (p == end)
+            break;
+        const char *name = p;
+        while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+            p++;
+        http_str_t str = {name - (const char *)data, p - name};
+        const char *item_end = memchr(p, ',', end - p);
+        if (item_end == NULL)
+            item_end = end;
+
+        //参数里只关心q，0、0.0、0.00、0.000都表示不接受
+        int q = 1;
+        while ((p = memchr(p, ';', item_end - p)) != NULL)
+        {
+            p++;
+            while (p < item_end && (*p == ' ' || *p == '\t'))
+                p++;
+            if (item_end - p < 2 || (*p != 'q' && *p != 'Q') || p[1] != '=')
+                continue;
+            p += 2;
+            if (p < item_end && *p == '0')
+            {
+                p++;
+                if (p < item_end && *p == '.')
+                    while (++p < item_end && *p == '0')
+                        ;
+                while (p < item_end && (*p == ' ' || *p == '\t'))
+                    p++;
+                q = p != item_end && *p != ';';
+            }
+        }
+
+        if (http_str_case_eq(data, str, coding))
+            return q;
+        if (http_str_eq(data, str, "*"))
+            star = q;
+        p = item_end;
+    }
+    return star;
+}
+
+/**
+ * @brief 解析十进制数字，最多解析到end
+ *
+ * @param p 起点，返回时指向数字之后
+ * @param end
+ * @param v 解析结果，溢出时为UINT64_MAX
+ * @return int 至少有一位数字时为0
+ */
+static int http_parse_u64(const char **p, const char *end, uint64_t *v)
+{
+    const char *s = *p;
+    *v = 0;
+    while (*p < end && **p >= '0' && **p <= '9')
+    {
+        *v = *v > (UINT64_MAX - 9) / 10 ? UINT64_MAX : *v * 10 + (**p - '0');
+        (*p)++;
+    }
+    return *p == s ? -1 : 0;
+}
+
+/**
+ * @brief 解析Range首部"bytes=a-b, c-, -n"，区间按文件长度截断
+ *        起点超出文件的区间被跳过；全部被跳过时返回0，应回复416。
+ *        语法错误、单位不是bytes或区间数超过max时返回-1，应忽略Range发送整个文件
+ *
+ * @param data 解析时的请求起点
+ * @param str 首部的值
+ * @param size 文件长度
+ * @param ranges 解析结果
+ * @param max ranges的容量
+ * @return int 可满足的区间数
+ */
+int http_parse_range(const uint8_t *data, http_str_t str, size_t size, http_range_t *ranges, int max)
+{
+    const char *p = (const char *)data + str.off;
+    const char *end = p + str.len;
+    int count = 0, specs = 0;
+    if (str.len < 6 || !http_str_case_eq(data, (http_str_t){str.off, 6}, "bytes="))
+        return -1;
+    p += 6;
+
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        if (p < end && *p == ',')
+        {
+            p++;
+            continue;
+        }
+        if (p == end)
+            break;
+        if (++specs > max)
+            return -1;
+
+        uint64_t first, last;
+        if (*p == '-')
+        {
+            //后缀区间，最后n个字节
+            p++;
+            if (http_parse_u64(&p, end, &last) != 0)
+                return -1;
+            if (last != 0 && size != 0)
+                ranges[count++] = (http_range_t){size - (last < size ? last : size), last < size ? last : size};
+        }
+        else
+        {
+            if (http_parse_u64(&p, end, &first) != 0 || p == end || *p++ != '-')
+                return -1;
+            if (http_parse_u64(&p, end, &last) != 0)
+                last = UINT64_MAX;
+            else if (last < first)
+                return -1;
+            if (first < size)
+            {
+                if (last >= size)
+                    last = size - 1;
+                ranges[count++] = (http_range_t){first, last - first + 1};
+            }
+        }
+
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        if (p < end && *p != ',')
+            return -1;
+    }
+    return specs == 0 ? -1 : count;
+}
@@ -0,0 +1,125 @@
+#include "log.h"
+
+#ifdef LOG_ENABLE
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include "utils.h"
+
+typedef struct log_entry //环形缓冲区中的一条日志
+{
+    uint64_t time;        //写入时间(ms)
+    uint8_t sub;          //子系统
+    uint8_t level;        //级别
+    char msg[LOG_MSG_LEN];//格式化后的内容，过长时截断
+} log_entry_t;
+
+/**
+ * @brief 单生产者单消费者的无锁环形缓冲区
+ *        协议栈只写head，log_flush只写tail，两边各自用release发布、用acquire读取对方的下标，
+ *        因此即使把输出放到另一个线程也不需要加锁
+ */
+static log_entry_t log_ring[LOG_RING_SIZE];
+static atomic_size_t log_head; //下一个要写入的位置，只由生产者修改
+static atomic_size_t log_tail; //下一个要输出的位置，只由消费者修改
+static atomic_size_t log_drops;//缓冲区满时丢弃的日志数
+
+uint8_t log_levels[LOG_SUB_COUNT] = {
+    [LOG_ETH] = LOG_LEVEL,
+    [LOG_ARP] = LOG_LEVEL,
+    [LOG_IP] = LOG_LEVEL,
+    [LOG_ICMP] = LOG_LEVEL,
+    [LOG_UDP] = LOG_LEVEL,
+    [LOG_TCP] = LOG_LEVEL,
+    [LOG_HTTP] = LOG_LEVEL,
+};
+
+static const char *log_sub_names[LOG_SUB_COUNT] = {
+    [LOG_ETH] = "eth",
+    [LOG_ARP] = "arp",
+    [LOG_IP] = "ip",
+    [LOG_ICMP] = "icmp",
+    [LOG_UDP] = "udp",
+    [LOG_TCP] = "tcp",
+    [LOG_HTTP] = "http",
+};
+
+static const char *log_level_names[] = {
+    [LOG_ERROR] = "ERROR",
+    [LOG_WARN] = "WARN",
+    [LOG_INFO] = "INFO",
+    [LOG_DEBUG] = "DEBUG",
+};
+
+/**
+ * @brief 格式化一条日志并写入环形缓冲区，不做任何io
+ *        缓冲区满时丢弃这条日志并计数，不阻塞协议栈
+ *
+ * @param sub 子系统
+ * @param level 级别
+ * @param fmt printf格式
+ */
+void log_write(log_sub_t sub, log_level_t level, const char *fmt, ...)
+{
+    size_t head = atomic_load_explicit(&log_head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&log_tail, memory_order_acquire);
+    if (head - tail >= LOG_RING_SIZE)
+    {
+        atomic_fetch_add_explicit(&log_drops, 1, memory_order_relaxed);
+        return;
+    }
+
+    log_entry_t *entry = &log_ring[head & (LOG_RING_SIZE - 1)];
+    entry->time = time_ms();
+    entry->sub = sub;
+    entry->level = level;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(entry->msg, sizeof(entry->msg), fmt, ap);
+    va_end(ap);
+
+    atomic_store_explicit(&log_head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief 运行时调整一个子系统的日志级别
+ *        只能调低编译期的LOG_LEVEL，更详细的级别已经被编译掉了
+ *
+ * @param sub 子系统
+ * @param level 该子系统要输出的最详细级别
+ */
+void log_set_level(log_sub_t sub, log_level_t level)
+{
+    log_levels[sub] = level;
+}
+
+/**
+ * @brief 把环形缓冲区中的日志输出到stdout，在主循环中调用，不占用收发包的路径
+ *
+ * @return size_t 本次输出的日志数
+ */
+size_t log_flush()
+{
+    size_t tail = atomic_load_explicit(&log_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&log_head, memory_order_acquire);
+    size_t n = head - tail;
+
+    for (; tail != head; tail++)
+    {
+        log_entry_t *entry = &log_ring[tail & (LOG_RING_SIZE - 1)];
+        printf("[%llu.%03llu] %s %s: %s\n",
+               (unsigned long long)(entry->time / 1000), (unsigned long long)(entry->time % 1000),
+               log_level_names[entry->level], log_sub_names[entry->sub], entry->msg);
+        atomic_store_explicit(&log_tail, tail + 1, memory_order_release);
+    }
+
+    size_t drops = atomic_exchange_explicit(&log_drops, 0, memory_order_relaxed);
+    if (drops)
+        printf("log: %zu messages dropped\n", drops);
+    if (n || drops)
+        fflush(stdout);
+    return n;
+}
+
+#endif
@@ -3,6 +3,8 @@
 #include "tcp.h"
 #include "http.h"
 #include "driver.h"
+#include "log.h"
+#include "aio.h"
 #include "time.h"
 
 #pragma GCC diagnostic push
@@ -23,13 +25,20 @@ void udp_handler(uint8_t* data, size_t len, uint8_t* src_ip, uint16_t src_port)
 
 #ifdef TCP
 void tcp_handler(tcp_connect_t* connect, connect_state_t state) {
+    if (state != TCP_CONN_DATA_RECV)
+        return;
     uint8_t buf[512];
     size_t len = tcp_connect_read(connect, buf, sizeof(buf) - 1);
-    buf[len] = 0;
-    printf("recv tcp packet from %s:%u len=%zu\n",
-        iptos(connect->ip), connect->remote_port, len);
-    printf("%s\n", buf);
-    tcp_connect_write(connect, buf, len);
+    if (len != 0) {
+        buf[len] = 0;
+        printf("recv tcp packet from %s:%u len=%zu\n",
+            iptos(connect->ip), connect->remote_port, len);
+        printf("%s\n", buf);
+        tcp_connect_write(connect, buf, len);
+    }
+    //对端已经关闭，回显完后也关闭
+    if (connect->state == TCP_CLOSE_WAIT)
+        tcp_connect_close(connect);
 }
 #endif
 
@@ -54,9 +63,11 @@ int main(int argc, char const *argv[])
 	{
         //一次主循环
         net_poll(); //一次主循环
+        aio_poll(); //回调读完的文件，和收发包在同一个线程
 #ifdef HTTP
         http_server_run();
 #endif
+        log_flush(); //日志在收发包之外统一输出
         // 节约用电
         struct timespec sleepTime = { 0, 1000000 };
         nanosleep(&sleepTime, NULL);
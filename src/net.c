@@ -100,4 +100,7 @@ void net_poll()
 #ifdef ETHERNET
     ethernet_poll();
 #endif
+#ifdef TCP
+    tcp_poll();
+#endif
 }
\ No newline at end of file
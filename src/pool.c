@@ -0,0 +1,78 @@
+#include <assert.h>
+#include <string.h>
+#include "pool.h"
+
+#define POOL_ALIGN 16 //对象对齐字节数
+
+/**
+ * @brief 初始化对象池，预分配capacity个对象并全部放入空闲链表
+ * 
+ * @param pool 要初始化的对象池
+ * @param obj_len 对象的长度
+ * @param capacity 对象总数
+ * @return int 成功为0，内存不足为-1
+ */
+int pool_init(pool_t *pool, size_t obj_len, size_t capacity)
+{
+    if (obj_len < sizeof(void *))
+        obj_len = sizeof(void *);
+    obj_len = (obj_len + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+
+    memset(pool, 0, sizeof(pool_t));
+    pool->data = malloc(obj_len * capacity);
+    if (pool->data == NULL)
+        return -1;
+    pool->obj_len = obj_len;
+    pool->capacity = capacity;
+    for (size_t i = capacity; i > 0; i--)
+    {
+        void *obj = pool->data + (i - 1) * obj_len;
+        *(void **)obj = pool->free_list;
+        pool->free_list = obj;
+    }
+    return 0;
+}
+
+/**
+ * @brief 从对象池中取出一个对象
+ * 
+ * @param pool 要操作的对象池
+ * @return void* 对象指针，池已空时为NULL
+ */
+void *pool_alloc(pool_t *pool)
+{
+    void *obj = pool->free_list;
+    if (obj == NULL)
+        return NULL;
+    pool->free_list = *(void **)obj;
+    pool->used++;
+    return obj;
+}
+
+/**
+ * @brief 把对象还给对象池
+ * 
+ * @param pool 要操作的对象池
+ * @param obj 由pool_alloc取出的对象，为NULL时什么也不做
+ */
+void pool_free(pool_t *pool, void *obj)
+{
+    if (obj == NULL)
+        return;
+    assert((uint8_t *)obj >= pool->data && (uint8_t *)obj < pool->data + pool->obj_len * pool->capacity);
+    assert(((uint8_t *)obj - pool->data) % pool->obj_len == 0);
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->used--;
+}
+
+/**
+ * @brief 获取对象池已分配的对象数
+ * 
+ * @param pool 要获取的对象池
+ * @return size_t 已分配的对象数
+ */
+size_t pool_used(pool_t *pool)
+{
+    return pool->used;
+}
@@ -1,15 +1,908 @@
 #include <assert.h>
-#include "map.h"
 #include "tcp.h"
+#include "pool.h"
 #include "ip.h"
+#include "log.h"
 
 static void panic(const char* msg, int line) {
     printf("panic %s! at line %d\n", msg, line);
     assert(0);
 }
 
-static void display_flags(tcp_flags_t flags) {
-    printf("flags:%s%s%s%s%s%s%s%s\n",
+typedef struct tcp_listener {
+    struct tcp_listener* next;
+    uint16_t port;
+    tcp_handler_t handler;
+    size_t backlog;              // accept队列长度，为0时不排队，建立连接后直接回调TCP_CONN_CONNECTED
+    size_t queued;               // accept队列中的连接数
+    tcp_connect_t* accept_head;  // 已建立但还没有被tcp_accept取走的连接，通过accept_next串起来
+    tcp_connect_t** accept_tail;
+    size_t drops;                // accept队列满时丢弃的握手数
+} tcp_listener_t;
+
+// 监听表，local port -> tcp_listener_t，按端口哈希后用链表解决冲突
+static tcp_listener_t* listen_table[TCP_LISTEN_HASH_SIZE];
+
+/* 连接表，按[remote ip, remote port, local port]哈希后用链表解决冲突，
+    链表节点就是tcp_connect_t本身，通过hash_next串起来。
+*/
+static tcp_connect_t* connect_table[TCP_HASH_SIZE];
+static size_t connect_count;
+
+// 最近一次命中的连接，同一条流的连续报文段不用再计算哈希
+static tcp_connect_t* last_connect;
+
+// 主动打开时分配本地端口的计数器
+static uint32_t ephemeral_next;
+
+static uint32_t hash_seed;
+
+// 当前处于SYN_RCVD状态的半连接数
+static size_t half_open;
+
+// 初始序号和syn cookie的SipHash密钥，在tcp_init时随机生成
+static uint8_t isn_secret[16];
+static uint8_t cookie_secret[16];
+
+#define TCP_COOKIE_PERIOD_MS 64000 // syn cookie计数器的周期
+#define TCP_COOKIE_MAX_AGE 1       // syn cookie最多可以跨越的周期数
+
+// syn cookie能编码的mss，用3位下标表示，取不超过对端mss的最大一项；对端mss比第一项还小时不用cookie
+static const uint16_t cookie_mss_table[] = { 216, 536, 1024, 1200, 1360, 1400, 1440, 1460 };
+
+// 连接对象池和收发缓存池，在tcp_init时一次性分配，连接的建立和关闭不再调用malloc/free
+static pool_t connect_pool;
+static pool_t rx_pool; //接收缓存池，每个连接一个，按TCP_RCV_BUF_LEN分配
+static pool_t tx_pool; //发送缓存池，每个连接一个，按TCP_SND_BUF_LEN分配
+
+// TIME_WAIT记录，只保留回复重传fin所需的字段，连接本身和收发缓存在进入TIME_WAIT时就释放
+typedef struct tcp_tw {
+    struct tcp_tw* hash_next;
+    uint8_t ip[NET_IP_LEN];
+    uint16_t local_port, remote_port;
+    uint32_t snd_nxt; // 我方fin之后的序号
+    uint32_t rcv_nxt; // 对端fin之后的序号
+    timer_node_t timer;
+} tcp_tw_t;
+
+// TIME_WAIT表，与连接表使用相同的哈希函数
+static tcp_tw_t* tw_table[TCP_HASH_SIZE];
+static pool_t tw_pool;
+
+// tcp所有定时器共用的时间轮，由tcp_poll推进
+static timer_wheel_t tcp_timers;
+
+static inline uint32_t fmix32(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/**
+ * @brief 计算连接四元组的哈希值，本地ip只有一个所以不参与计算
+ *
+ * @param ip 远端ip
+ * @param remote_port
+ * @param local_port
+ * @return uint32_t
+ */
+static uint32_t tcp_hash(const uint8_t* ip, uint16_t remote_port, uint16_t local_port) {
+    uint32_t addr;
+    memcpy(&addr, ip, NET_IP_LEN);
+    return fmix32(fmix32(addr ^ hash_seed) ^ ((uint32_t)remote_port << 16 | local_port));
+}
+
+/**
+ * @brief 在连接表中查找连接
+ *
+ * @param ip 远端ip
+ * @param remote_port
+ * @param local_port
+ * @return tcp_connect_t* 找不到为NULL
+ */
+static tcp_connect_t* tcp_lookup(const uint8_t* ip, uint16_t remote_port, uint16_t local_port) {
+    tcp_connect_t* connect = last_connect;
+    if (connect && connect->remote_port == remote_port && connect->local_port == local_port &&
+        !memcmp(connect->ip, ip, NET_IP_LEN))
+        return connect;
+    connect = connect_table[tcp_hash(ip, remote_port, local_port) & (TCP_HASH_SIZE - 1)];
+    while (connect) {
+        if (connect->remote_port == remote_port && connect->local_port == local_port &&
+            !memcmp(connect->ip, ip, NET_IP_LEN)) {
+            last_connect = connect;
+            return connect;
+        }
+        connect = connect->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 把连接插入连接表，四元组必须已经填好
+ *
+ * @param connect
+ */
+static void tcp_hash_insert(tcp_connect_t* connect) {
+    tcp_connect_t** bucket = &connect_table[tcp_hash(connect->ip, connect->remote_port, connect->local_port) & (TCP_HASH_SIZE - 1)];
+    connect->hash_next = *bucket;
+    *bucket = connect;
+    connect_count++;
+}
+
+/**
+ * @brief 把连接从连接表中删除
+ *
+ * @param connect
+ */
+static void tcp_hash_remove(tcp_connect_t* connect) {
+    tcp_connect_t** pp = &connect_table[tcp_hash(connect->ip, connect->remote_port, connect->local_port) & (TCP_HASH_SIZE - 1)];
+    while (*pp && *pp != connect)
+        pp = &(*pp)->hash_next;
+    if (*pp) {
+        *pp = connect->hash_next;
+        connect_count--;
+    }
+    if (last_connect == connect)
+        last_connect = NULL;
+}
+
+/**
+ * @brief 在TIME_WAIT表中查找记录
+ *
+ * @param ip 远端ip
+ * @param remote_port
+ * @param local_port
+ * @return tcp_tw_t* 找不到为NULL
+ */
+static tcp_tw_t* tcp_tw_lookup(const uint8_t* ip, uint16_t remote_port, uint16_t local_port) {
+    tcp_tw_t* tw = tw_table[tcp_hash(ip, remote_port, local_port) & (TCP_HASH_SIZE - 1)];
+    while (tw) {
+        if (tw->remote_port == remote_port && tw->local_port == local_port && !memcmp(tw->ip, ip, NET_IP_LEN))
+            return tw;
+        tw = tw->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 删除TIME_WAIT记录并还给记录池
+ *
+ * @param tw
+ */
+static void tcp_tw_remove(tcp_tw_t* tw) {
+    tcp_tw_t** pp = &tw_table[tcp_hash(tw->ip, tw->remote_port, tw->local_port) & (TCP_HASH_SIZE - 1)];
+    while (*pp && *pp != tw)
+        pp = &(*pp)->hash_next;
+    if (*pp)
+        *pp = tw->hash_next;
+    timer_del(&tcp_timers, &tw->timer);
+    pool_free(&tw_pool, tw);
+}
+
+/**
+ * @brief TIME_WAIT到期
+ *
+ * @param node
+ */
+static void tcp_tw_timer(timer_node_t* node) {
+    tcp_tw_remove(timer_entry(node, tcp_tw_t, timer));
+}
+
+/**
+ * @brief 对连接表中的每个连接调用fn，fn可以释放传入的连接
+ *
+ * @param fn
+ */
+static void tcp_foreach(void (*fn)(tcp_connect_t* connect)) {
+    for (size_t i = 0; i < TCP_HASH_SIZE && connect_count; i++) {
+        tcp_connect_t* connect = connect_table[i];
+        while (connect) {
+            tcp_connect_t* next = connect->hash_next;
+            fn(connect);
+            connect = next;
+        }
+    }
+}
+
+/**
+ * @brief 在监听表中查找端口
+ *
+ * @param port
+ * @return tcp_listener_t* 找不到为NULL
+ */
+static tcp_listener_t* tcp_listener_get(uint16_t port) {
+    tcp_listener_t* listener = listen_table[port & (TCP_LISTEN_HASH_SIZE - 1)];
+    while (listener && listener->port != port)
+        listener = listener->next;
+    return listener;
+}
+
+/**
+ * @brief 初始化tcp的监听表和连接表
+ *        供应用层使用
+ *
+ */
+void tcp_init() {
+    memset(listen_table, 0, sizeof(listen_table));
+    memset(connect_table, 0, sizeof(connect_table));
+    connect_count = 0;
+    last_connect = NULL;
+    random_bytes((uint8_t*)&hash_seed, sizeof(hash_seed));
+    random_bytes(isn_secret, sizeof(isn_secret));
+    random_bytes(cookie_secret, sizeof(cookie_secret));
+    half_open = 0;
+    memset(tw_table, 0, sizeof(tw_table));
+    timer_wheel_init(&tcp_timers, time_ms());
+    if (pool_init(&connect_pool, sizeof(tcp_connect_t), TCP_MAX_CONNECT) != 0 ||
+        pool_init(&rx_pool, sizeof(tcp_buf_t) + TCP_RCV_BUF_LEN, TCP_MAX_CONNECT) != 0 ||
+        pool_init(&tx_pool, sizeof(tcp_buf_t) + TCP_SND_BUF_LEN, TCP_MAX_CONNECT) != 0 ||
+        pool_init(&tw_pool, sizeof(tcp_tw_t), TCP_MAX_TIME_WAIT) != 0) {
+        fprintf(stderr, "Error in tcp_init: out of memory\n");
+        return;
+    }
+    net_add_protocol(NET_PROTOCOL_TCP, tcp_in);
+}
+
+/**
+ * @brief 向 port 注册一个 TCP 连接以及关联的回调函数
+ *        供应用层使用
+ *
+ * @param port
+ * @param handler
+ * @return int 成功为0，失败为-1
+ */
+int tcp_open(uint16_t port, tcp_handler_t handler) {
+    return tcp_listen(port, 0, handler);
+}
+
+/**
+ * @brief 在 port 上监听，握手完成的连接放入长度为backlog的accept队列，由应用调用tcp_accept取走。
+ *        队列满时新的握手被丢弃并计数，对端会重传。backlog为0时等同于tcp_open。
+ *        之后连接上的TCP_CONN_DATA_RECV、TCP_CONN_CLOSED仍然通过handler通知。
+ *        供应用层使用
+ *
+ * @param port
+ * @param backlog accept队列长度，不超过TCP_MAX_CONNECT
+ * @param handler
+ * @return int 成功为0，失败为-1
+ */
+int tcp_listen(uint16_t port, size_t backlog, tcp_handler_t handler) {
+    LOG(LOG_TCP, LOG_INFO, "listen on port %u, backlog %zu", port, backlog);
+    tcp_listener_t* listener = tcp_listener_get(port);
+    if (listener == NULL) {
+        listener = malloc(sizeof(tcp_listener_t));
+        if (listener == NULL)
+            return -1;
+        listener->port = port;
+        listener->queued = 0;
+        listener->accept_head = NULL;
+        listener->accept_tail = &listener->accept_head;
+        listener->drops = 0;
+        listener->next = listen_table[port & (TCP_LISTEN_HASH_SIZE - 1)];
+        listen_table[port & (TCP_LISTEN_HASH_SIZE - 1)] = listener;
+    }
+    listener->handler = handler;
+    listener->backlog = min32(backlog, TCP_MAX_CONNECT);
+    return 0;
+}
+
+/**
+ * @brief 从 port 的accept队列中取出一个已建立的连接
+ *        供应用层使用
+ *
+ * @param port
+ * @return tcp_connect_t* 队列为空或端口没有监听时为NULL
+ */
+tcp_connect_t* tcp_accept(uint16_t port) {
+    tcp_listener_t* listener = tcp_listener_get(port);
+    if (listener == NULL || listener->accept_head == NULL)
+        return NULL;
+    tcp_connect_t* connect = listener->accept_head;
+    listener->accept_head = connect->accept_next;
+    if (listener->accept_head == NULL)
+        listener->accept_tail = &listener->accept_head;
+    listener->queued--;
+    connect->accept_next = NULL;
+    connect->accepting = 0;
+    return connect;
+}
+
+/**
+ * @brief 查询 port 因accept队列满而丢弃的握手数
+ *        供应用层使用
+ *
+ * @param port
+ * @return size_t
+ */
+size_t tcp_listen_drops(uint16_t port) {
+    tcp_listener_t* listener = tcp_listener_get(port);
+    return listener ? listener->drops : 0;
+}
+
+/**
+ * @brief accept队列是否已满
+ *
+ * @param listener
+ * @return int
+ */
+static int tcp_accept_full(tcp_listener_t* listener) {
+    return listener != NULL && listener->backlog != 0 && listener->queued >= listener->backlog;
+}
+
+/**
+ * @brief 连接从SYN_RCVD进入ESTABLISHED，被动打开的连接有accept队列时排队，
+ *        否则以及同时打开的连接直接通知应用
+ *
+ * @param connect
+ */
+static void tcp_established(tcp_connect_t* connect) {
+    tcp_listener_t* listener = connect->active ? NULL : tcp_listener_get(connect->local_port);
+    if (listener == NULL || listener->backlog == 0) {
+        ((tcp_handler_t)connect->handler)(connect, TCP_CONN_CONNECTED);
+        return;
+    }
+    connect->accept_next = NULL;
+    connect->accepting = 1;
+    *listener->accept_tail = connect;
+    listener->accept_tail = &connect->accept_next;
+    listener->queued++;
+}
+
+/**
+ * @brief 把还没有被tcp_accept取走的连接从accept队列中删除
+ *
+ * @param connect
+ */
+static void tcp_accept_remove(tcp_connect_t* connect) {
+    tcp_listener_t* listener = tcp_listener_get(connect->local_port);
+    if (listener == NULL)
+        return;
+    tcp_connect_t** pp = &listener->accept_head;
+    while (*pp && *pp != connect)
+        pp = &(*pp)->accept_next;
+    if (*pp == NULL)
+        return;
+    *pp = connect->accept_next;
+    if (listener->accept_tail == &connect->accept_next)
+        listener->accept_tail = pp;
+    listener->queued--;
+}
+
+static void tcp_delack_timer(timer_node_t* node);
+static void tcp_persist_timer(timer_node_t* node);
+static void tcp_syn_timer(timer_node_t* node);
+static void tcp_fin_timer(timer_node_t* node);
+static void tcp_send(buf_t* buf, tcp_connect_t* connect, tcp_flags_t flags);
+
+/**
+ * @brief 初始化连接的收发缓存为空，数据从头部开始存放
+ *
+ * @param buf
+ * @param size payload的容量
+ */
+static void tcp_buf_init(tcp_buf_t* buf, uint32_t size) {
+    buf->len = 0;
+    buf->size = size;
+    buf->data = buf->payload;
+}
+
+/**
+ * @brief 从连接池分配一个新连接并分配收发缓存，状态为TCP_SYN_RCVD，但还没有加入连接表
+ *        rx_buf和tx_buf在触及边界时会把数据重新移动到头部，防止溢出。
+ *
+ * @return tcp_connect_t* 连接池或缓存池已空时为NULL
+ */
+static tcp_connect_t* new_tcp_connect_rcvd() {
+    tcp_connect_t* connect = pool_alloc(&connect_pool);
+    if (connect == NULL)
+        return NULL;
+    connect->rx_buf = pool_alloc(&rx_pool);
+    connect->tx_buf = pool_alloc(&tx_pool);
+    if (connect->rx_buf == NULL || connect->tx_buf == NULL) {
+        pool_free(&rx_pool, connect->rx_buf);
+        pool_free(&tx_pool, connect->tx_buf);
+        pool_free(&connect_pool, connect);
+        return NULL;
+    }
+    tcp_buf_init(connect->rx_buf, TCP_RCV_BUF_LEN);
+    tcp_buf_init(connect->tx_buf, TCP_SND_BUF_LEN);
+    connect->txq_head = 0;
+    connect->txq_count = 0;
+    connect->tx_len = 0;
+    connect->accept_next = NULL;
+    connect->accepting = 0;
+    connect->active = 0;
+    connect->arg = NULL;
+    connect->want_write = 0;
+    connect->nodelay = 0;
+    connect->cork = 0;
+    connect->ooo_count = 0;
+    connect->quickack = TCP_QUICKACK_SEGS;
+    timer_node_init(&connect->ack_timer, tcp_delack_timer);
+    connect->fin_pending = 0;
+    connect->persist_backoff = 0;
+    timer_node_init(&connect->persist_timer, tcp_persist_timer);
+    connect->syn_retries = 0;
+    timer_node_init(&connect->syn_timer, tcp_syn_timer);
+    connect->fin_retries = 0;
+    timer_node_init(&connect->fin_timer, tcp_fin_timer);
+    connect->state = TCP_SYN_RCVD;
+    return connect;
+}
+
+/**
+ * @brief 初始化zbuf，应用持有初始的一个引用
+ *        供应用层使用
+ *
+ * @param zbuf
+ * @param data 在引用计数归零之前必须保持有效且不被修改
+ * @param len
+ * @param done 引用计数归零时调用，可以为NULL
+ * @param arg
+ */
+void tcp_zbuf_init(tcp_zbuf_t* zbuf, const uint8_t* data, size_t len, tcp_zbuf_done_t done, void* arg) {
+    zbuf->data = data;
+    zbuf->len = len;
+    zbuf->ref = 1;
+    zbuf->done = done;
+    zbuf->arg = arg;
+}
+
+/**
+ * @brief 增加zbuf的引用
+ *        供应用层使用
+ *
+ * @param zbuf
+ */
+void tcp_zbuf_get(tcp_zbuf_t* zbuf) {
+    zbuf->ref++;
+}
+
+/**
+ * @brief 释放zbuf的一个引用，归零时调用done
+ *        供应用层使用
+ *
+ * @param zbuf
+ */
+void tcp_zbuf_put(tcp_zbuf_t* zbuf) {
+    assert(zbuf->ref > 0);
+    if (--zbuf->ref == 0 && zbuf->done)
+        zbuf->done(zbuf);
+}
+
+/**
+ * @brief 发送队列中的第i段
+ *
+ * @param connect
+ * @param i
+ * @return tcp_tx_chunk_t*
+ */
+static inline tcp_tx_chunk_t* tcp_txq_at(tcp_connect_t* connect, uint32_t i) {
+    return &connect->txq[(connect->txq_head + i) % TCP_TXQ_LEN];
+}
+
+/**
+ * @brief 从发送队列头部删去已确认的n字节，拷贝的数据从tx_buf中删去，zbuf整段确认后释放引用
+ *
+ * @param connect
+ * @param n
+ */
+static void tcp_txq_ack(tcp_connect_t* connect, uint32_t n) {
+    connect->tx_len -= n;
+    while (n != 0 && connect->txq_count != 0) {
+        tcp_tx_chunk_t* chunk = tcp_txq_at(connect, 0);
+        uint32_t k = min32(n, chunk->len);
+        if (chunk->zbuf == NULL) {
+            connect->tx_buf->data += k;
+            connect->tx_buf->len -= k;
+        }
+        chunk->off += k;
+        chunk->len -= k;
+        n -= k;
+        if (chunk->len != 0)
+            break;
+        if (chunk->zbuf)
+            tcp_zbuf_put(chunk->zbuf);
+        connect->txq_head = (connect->txq_head + 1) % TCP_TXQ_LEN;
+        connect->txq_count--;
+    }
+}
+
+/**
+ * @brief 把发送队列中从off开始的len字节拷贝到dst，zbuf中的数据从应用的缓存直接拷进报文
+ *
+ * @param connect
+ * @param off 相对unack_seq的偏移
+ * @param dst
+ * @param len
+ */
+static void tcp_txq_copy(tcp_connect_t* connect, uint32_t off, uint8_t* dst, uint32_t len) {
+    uint32_t copy_off = 0; // 当前段之前的拷贝数据在tx_buf中占用的长度
+    for (uint32_t i = 0; i < connect->txq_count && len != 0; i++) {
+        tcp_tx_chunk_t* chunk = tcp_txq_at(connect, i);
+        if (off < chunk->len) {
+            uint32_t k = min32(chunk->len - off, len);
+            if (chunk->zbuf)
+                memcpy(dst, chunk->zbuf->data + chunk->off + off, k);
+            else
+                memcpy(dst, connect->tx_buf->data + copy_off + off, k);
+            dst += k;
+            len -= k;
+            off = 0;
+        } else {
+            off -= chunk->len;
+        }
+        if (chunk->zbuf == NULL)
+            copy_off += chunk->len;
+    }
+}
+
+/**
+ * @brief 释放TCP连接，把它从连接表中删除并把连接和缓存还给对象池。
+ *
+ * @param connect
+ */
+static void release_tcp_connect(tcp_connect_t* connect) {
+    if (connect->state == TCP_SYN_RCVD)
+        half_open--;
+    if (connect->accepting)
+        tcp_accept_remove(connect);
+    tcp_hash_remove(connect);
+    timer_del(&tcp_timers, &connect->ack_timer);
+    timer_del(&tcp_timers, &connect->persist_timer);
+    timer_del(&tcp_timers, &connect->syn_timer);
+    timer_del(&tcp_timers, &connect->fin_timer);
+    tcp_txq_ack(connect, connect->tx_len);
+    pool_free(&rx_pool, connect->rx_buf);
+    pool_free(&tx_pool, connect->tx_buf);
+    pool_free(&connect_pool, connect);
+}
+
+/**
+ * @brief 用SipHash对连接四元组和两个附加字段计算带密钥的哈希
+ *
+ * @param key 密钥
+ * @param ip 远端ip
+ * @param remote_port
+ * @param local_port
+ * @param a,b 附加字段
+ * @return uint32_t
+ */
+static uint32_t tcp_keyed_hash(const uint8_t key[16], const uint8_t* ip, uint16_t remote_port, uint16_t local_port, uint32_t a, uint32_t b) {
+    uint8_t data[NET_IP_LEN + 12];
+    memcpy(data, ip, NET_IP_LEN);
+    memcpy(data + NET_IP_LEN, &remote_port, 2);
+    memcpy(data + NET_IP_LEN + 2, &local_port, 2);
+    memcpy(data + NET_IP_LEN + 4, &a, 4);
+    memcpy(data + NET_IP_LEN + 8, &b, 4);
+    return (uint32_t)siphash24(key, data, sizeof(data));
+}
+
+/**
+ * @brief 按RFC 6528生成初始序号：4微秒递增的时钟加上四元组的带密钥哈希，
+ *        既不会被对端预测，同一四元组的新连接序号也会单调增长。
+ *
+ * @param ip 远端ip
+ * @param remote_port
+ * @param local_port
+ * @return uint32_t
+ */
+static uint32_t tcp_new_isn(const uint8_t* ip, uint16_t remote_port, uint16_t local_port) {
+    return (uint32_t)(time_ms() * 250) + tcp_keyed_hash(isn_secret, ip, remote_port, local_port, 0, 0);
+}
+
+/**
+ * @brief 生成syn cookie作为syn-ack的初始序号
+ *        高5位为计数器，接下来3位为mss下标，低24位为四元组、对端序号和计数器的带密钥哈希。
+ *
+ * @param ip 远端ip
+ * @param remote_port
+ * @param local_port
+ * @param peer_isn 对端syn的序号
+ * @param mss 对端mss，不小于cookie_mss_table[0]
+ * @return uint32_t
+ */
+static uint32_t tcp_cookie_make(const uint8_t* ip, uint16_t remote_port, uint16_t local_port, uint32_t peer_isn, uint16_t mss) {
+    uint32_t count = time_ms() / TCP_COOKIE_PERIOD_MS;
+    uint32_t idx = sizeof(cookie_mss_table) / sizeof(cookie_mss_table[0]) - 1;
+    assert(mss >= cookie_mss_table[0]);
+    while (cookie_mss_table[idx] > mss)
+        idx--;
+    uint32_t hash = tcp_keyed_hash(cookie_secret, ip, remote_port, local_port, peer_isn, count);
+    return (count & 0x1f) << 27 | idx << 24 | (hash & 0xffffff);
+}
+
+/**
+ * @brief 校验第三次握手ack中的syn cookie
+ *
+ * @param ip 远端ip
+ * @param remote_port
+ * @param local_port
+ * @param peer_isn 对端syn的序号，即第三次握手的seq - 1
+ * @param cookie 即第三次握手的ack - 1
+ * @return uint16_t cookie中编码的mss，无效或过期时为0
+ */
+static uint16_t tcp_cookie_check(const uint8_t* ip, uint16_t remote_port, uint16_t local_port, uint32_t peer_isn, uint32_t cookie) {
+    uint32_t count = time_ms() / TCP_COOKIE_PERIOD_MS;
+    uint32_t age = (count - (cookie >> 27)) & 0x1f;
+    if (age > TCP_COOKIE_MAX_AGE)
+        return 0;
+    uint32_t hash = tcp_keyed_hash(cookie_secret, ip, remote_port, local_port, peer_isn, count - age);
+    if ((hash & 0xffffff) != (cookie & 0xffffff))
+        return 0;
+    return cookie_mss_table[(cookie >> 24) & 0x7];
+}
+
+/**
+ * @brief 从tcp头的选项中取出mss
+ *
+ * @param hdr
+ * @return uint16_t 对端mss，没有mss选项时为TCP_DEFAULT_MSS，不会超过本机TCP_MSS
+ */
+static uint16_t tcp_parse_mss(tcp_hdr_t* hdr) {
+    uint8_t* opt = (uint8_t*)(hdr + 1);
+    uint8_t* end = (uint8_t*)hdr + hdr->data_offset * sizeof(uint32_t);
+    while (opt < end && *opt != TCP_OPT_END) {
+        if (*opt == TCP_OPT_NOP) {
+            opt++;
+            continue;
+        }
+        if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end)
+            break;
+        if (opt[0] == TCP_OPT_MSS && opt[1] == TCP_OPT_MSS_LEN) {
+            uint16_t mss = opt[2] << 8 | opt[3];
+            return mss ? min32(mss, TCP_MSS) : TCP_DEFAULT_MSS;
+        }
+        opt += opt[1];
+    }
+    return TCP_DEFAULT_MSS;
+}
+
+static uint16_t tcp_checksum(buf_t* buf, uint8_t* src_ip, uint8_t* dst_ip) {
+    uint16_t len = (uint16_t)buf->len;
+    tcp_peso_hdr_t* peso_hdr = (tcp_peso_hdr_t*)(buf->data - sizeof(tcp_peso_hdr_t));
+    tcp_peso_hdr_t pre; //暂存被覆盖的IP头
+    memcpy(&pre, peso_hdr, sizeof(tcp_peso_hdr_t));
+    memcpy(peso_hdr->src_ip, src_ip, NET_IP_LEN);
+    memcpy(peso_hdr->dst_ip, dst_ip, NET_IP_LEN);
+    peso_hdr->placeholder = 0;
+    peso_hdr->protocol = NET_PROTOCOL_TCP;
+    peso_hdr->total_len16 = swap16(len);
+    uint16_t checksum = checksum16((uint16_t*)peso_hdr, len + sizeof(tcp_peso_hdr_t));
+    memcpy(peso_hdr, &pre, sizeof(tcp_peso_hdr_t));
+    return checksum;
+}
+
+static _Thread_local uint16_t delete_port;
+
+/**
+ * @brief tcp_close使用这个函数来查找可以关闭的连接，使用thread-local变量delete_port传递端口号。
+ *        对端已经知道的连接先发送rst让它也放弃，应用已经拿到的连接通知TCP_CONN_CLOSED，然后释放
+ *
+ * @param connect
+ */
+static void close_port_fn(tcp_connect_t* connect) {
+    if (connect->local_port != delete_port)
+        return;
+    //SYN_SEND还没有收到对端的任何报文，没有可以确认的序号，直接放弃
+    if (connect->state != TCP_SYN_SEND) {
+        buf_init(&txbuf, 0);
+        tcp_send(&txbuf, connect, tcp_flags_ack_rst);
+    }
+    if ((connect->state != TCP_SYN_RCVD || connect->active) && !connect->accepting)
+        ((tcp_handler_t)connect->handler)(connect, TCP_CONN_CLOSED);
+    release_tcp_connect(connect);
+}
+
+/**
+ * @brief 关闭 port 上的 TCP 连接并停止监听，连接被复位而不是正常关闭，还没有发出的数据被丢弃
+ *        供应用层使用
+ *
+ * @param port
+ */
+void tcp_close(uint16_t port) {
+    delete_port = port;
+    tcp_foreach(close_port_fn);
+    tcp_listener_t** pp = &listen_table[port & (TCP_LISTEN_HASH_SIZE - 1)];
+    while (*pp && (*pp)->port != port)
+        pp = &(*pp)->next;
+    if (*pp) {
+        tcp_listener_t* listener = *pp;
+        *pp = listener->next;
+        free(listener);
+    }
+}
+
+/**
+ * @brief 乱序区间占用的rx_buf尾部空间，即最后一个乱序区间的末尾相对ack的偏移
+ *
+ * @param connect
+ * @return uint32_t 字节数
+ */
+static uint32_t tcp_ooo_extent(tcp_connect_t* connect) {
+    if (connect->ooo_count == 0)
+        return 0;
+    tcp_ooo_seg_t* last = &connect->ooo[connect->ooo_count - 1];
+    return last->seq + last->len - connect->ack;
+}
+
+/**
+ * @brief 保证rx_buf有效数据之后至少有size字节可用，不够时把有效数据连同乱序数据移动到头部
+ *
+ * @param connect
+ * @param size
+ * @return int 成功为0，空间不足为-1
+ */
+static int tcp_rx_reserve(tcp_connect_t* connect, size_t size) {
+    tcp_buf_t* rx_buf = connect->rx_buf;
+    if (rx_buf->data + rx_buf->len + size <= rx_buf->payload + rx_buf->size)
+        return 0;
+    if (rx_buf->len + size > rx_buf->size)
+        return -1;
+    memmove(rx_buf->payload, rx_buf->data, rx_buf->len + tcp_ooo_extent(connect));
+    rx_buf->data = rx_buf->payload;
+    return 0;
+}
+
+/**
+ * @brief 把一个乱序到达的报文段放进rx_buf对应偏移处，并记录到乱序区间表，重叠或相邻的区间会被合并。
+ *        超出接收窗口或区间表已满时丢弃。
+ *
+ * @param connect
+ * @param buf 去掉tcp头之后的负载
+ * @param seq 负载的起始序号，必须在connect->ack之后
+ */
+static void tcp_ooo_in(tcp_connect_t* connect, buf_t* buf, uint32_t seq) {
+    uint32_t off = seq - connect->ack;
+    if (TCP_SEQ_GT(seq + buf->len, connect->rcv_wnd_edge) || tcp_rx_reserve(connect, off + buf->len) != 0)
+        return;
+
+    tcp_ooo_seg_t* ooo = connect->ooo;
+    uint8_t count = connect->ooo_count;
+    uint32_t end = seq + buf->len;
+
+    //找到第一个与新区间重叠或相邻的区间，并吸收其后所有与之重叠的区间
+    uint8_t i = 0;
+    while (i < count && TCP_SEQ_LT(ooo[i].seq + ooo[i].len, seq))
+        i++;
+    uint8_t j = i;
+    while (j < count && TCP_SEQ_LEQ(ooo[j].seq, end)) {
+        if (TCP_SEQ_LT(ooo[j].seq, seq))
+            seq = ooo[j].seq;
+        if (TCP_SEQ_GT(ooo[j].seq + ooo[j].len, end))
+            end = ooo[j].seq + ooo[j].len;
+        j++;
+    }
+    if (i == j) {
+        if (count == TCP_OOO_MAX_SEG)
+            return;
+        memmove(&ooo[i + 1], &ooo[i], (count - i) * sizeof(tcp_ooo_seg_t));
+        count++;
+    } else {
+        memmove(&ooo[i + 1], &ooo[j], (count - j) * sizeof(tcp_ooo_seg_t));
+        count -= j - i - 1;
+    }
+
+    uint8_t* dst = connect->rx_buf->data + connect->rx_buf->len + off;
+    memcpy(dst, buf->data, buf->len);
+    ooo[i].seq = seq;
+    ooo[i].len = end - seq;
+    connect->ooo_count = count;
+}
+
+/**
+ * @brief 空洞被填上之后，把已经连续的乱序区间并入rx_buf的有效数据
+ *
+ * @param connect
+ * @return uint32_t 新并入的字节数
+ */
+static uint32_t tcp_ooo_merge(tcp_connect_t* connect) {
+    tcp_ooo_seg_t* ooo = connect->ooo;
+    uint32_t merged = 0;
+    while (connect->ooo_count && TCP_SEQ_LEQ(ooo[0].seq, connect->ack)) {
+        uint32_t end = ooo[0].seq + ooo[0].len;
+        if (TCP_SEQ_GT(end, connect->ack)) {
+            connect->rx_buf->len += end - connect->ack;
+            merged += end - connect->ack;
+            connect->ack = end;
+        }
+        connect->ooo_count--;
+        memmove(&ooo[0], &ooo[1], connect->ooo_count * sizeof(tcp_ooo_seg_t));
+        //填上空洞的报文段要立即确认，帮助对端尽快结束快速恢复
+        if (connect->quickack == 0)
+            connect->quickack = 1;
+    }
+    return merged;
+}
+
+/**
+ * @brief 从 buf 中读取数据到 connect->rx_buf，并把因此变得连续的乱序数据一并交付
+ *
+ * @param connect
+ * @param buf
+ * @return uint32_t 交付给rx_buf的字节数，窗口已满时为0
+ */
+static uint32_t tcp_read_from_buf(tcp_connect_t* connect, buf_t* buf) {
+    //超出通告窗口的部分丢弃
+    if (TCP_SEQ_GT(connect->ack + buf->len, connect->rcv_wnd_edge))
+        buf_remove_padding(buf, connect->ack + buf->len - connect->rcv_wnd_edge);
+    if (buf->len == 0 || tcp_rx_reserve(connect, buf->len) != 0)
+        return 0;
+    uint8_t* dst = connect->rx_buf->data + connect->rx_buf->len;
+    connect->rx_buf->len += buf->len;
+    memcpy(dst, buf->data, buf->len);
+    connect->ack += buf->len;
+    return buf->len + tcp_ooo_merge(connect);
+}
+
+/**
+ * @brief 下一段可以发送的数据长度，受对端窗口剩余部分和对端mss限制
+ *
+ * @param connect
+ * @return uint32_t 字节数
+ */
+static uint32_t tcp_send_size(tcp_connect_t* connect) {
+    uint32_t sent = connect->next_seq - connect->unack_seq;
+    uint32_t size = 0;
+    if (connect->tx_len > sent && connect->remote_win > sent) {
+        size = min32(connect->tx_len - sent, connect->remote_win - sent);
+        size = min32(size, connect->remote_mss);
+    }
+    return size;
+}
+
+/**
+ * @brief 把connect发送队列中下一段未发送的数据写入到buf里面供tcp_send使用，buf原来的内容会无效。
+ *        长度受对端窗口剩余部分和对端mss限制。
+ *
+ * @param connect
+ * @param buf
+ * @return uint16_t 字节数
+ */
+static uint16_t tcp_write_to_buf(tcp_connect_t* connect, buf_t* buf) {
+    uint32_t sent = connect->next_seq - connect->unack_seq;
+    uint32_t size = tcp_send_size(connect);
+    buf_init(buf, size);
+    tcp_txq_copy(connect, sent, buf->data, size);
+    connect->next_seq += size;
+    return size;
+}
+
+/**
+ * @brief 计算要通告的接收窗口，即rx_buf中还能容纳的字节数。
+ *        接收方糊涂窗口避免：右边界推进不足min(TCP_RCV_BUF_LEN / 2, TCP_MSS)时继续通告原来的右边界，窗口也不会收缩。
+ *
+ * @param connect
+ * @return uint16_t 窗口大小
+ */
+static uint16_t tcp_rcv_window(tcp_connect_t* connect) {
+    //没有分配缓存的无状态回复(rst、syn cookie)按空缓存通告
+    if (connect->state == TCP_LISTEN)
+        return TCP_RCV_BUF_LEN;
+    uint32_t used = min32(connect->rx_buf->len, TCP_RCV_BUF_LEN);
+    uint32_t edge = connect->ack + TCP_RCV_BUF_LEN - used;
+    if (TCP_SEQ_GEQ(edge, connect->rcv_wnd_edge + min32(TCP_RCV_BUF_LEN / 2, TCP_MSS)))
+        connect->rcv_wnd_edge = edge;
+    if (TCP_SEQ_LEQ(connect->rcv_wnd_edge, connect->ack))
+        return 0;
+    return connect->rcv_wnd_edge - connect->ack;
+}
+
+/**
+ * @brief 发送TCP包, seq_number32 = connect->next_seq - buf->len
+ *        buf里的数据将作为负载，加上tcp头发送出去。如果flags包含syn或fin，seq会递增。
+ *        syn报文会带上本机的mss选项。
+ *
+ * @param buf
+ * @param connect
+ * @param flags
+ */
+static void tcp_send(buf_t* buf, tcp_connect_t* connect, tcp_flags_t flags) {
+    LOG(LOG_TCP, LOG_DEBUG, "send %u -> %s:%u len=%zu flags:%s%s%s%s%s%s%s%s",
+        connect->local_port, iptos(connect->ip), connect->remote_port, buf->len,
         flags.cwr ? " cwr" : "",
         flags.ece ? " ece" : "",
         flags.urg ? " urg" : "",
@@ -17,260 +910,718 @@ static void display_flags(tcp_flags_t flags) {
         flags.psh ? " psh" : "",
         flags.rst ? " rst" : "",
         flags.syn ? " syn" : "",
-        flags.fin ? " fin" : ""
-    );
+        flags.fin ? " fin" : "");
+    size_t prev_len = buf->len;
+    size_t opt_len = flags.syn ? TCP_OPT_MSS_LEN : 0;
+    buf_add_header(buf, sizeof(tcp_hdr_t) + opt_len);
+    tcp_hdr_t* hdr = (tcp_hdr_t*)buf->data;
+    if (flags.syn) {
+        uint8_t* opt = (uint8_t*)(hdr + 1);
+        opt[0] = TCP_OPT_MSS;
+        opt[1] = TCP_OPT_MSS_LEN;
+        opt[2] = TCP_MSS >> 8;
+        opt[3] = TCP_MSS & 0xff;
+    }
+    hdr->src_port16 = swap16(connect->local_port);
+    hdr->dst_port16 = swap16(connect->remote_port);
+    hdr->seq_number32 = swap32(connect->next_seq - prev_len);
+    hdr->ack_number32 = swap32(connect->ack);
+    hdr->data_offset = (sizeof(tcp_hdr_t) + opt_len) / sizeof(uint32_t);
+    hdr->reserved = 0;
+    hdr->flags = flags;
+    hdr->window_size16 = swap16(tcp_rcv_window(connect));
+    hdr->chunksum16 = 0;
+    hdr->urgent_pointer16 = 0;
+    hdr->chunksum16 = swap16(tcp_checksum(buf, connect->ip, net_if_ip));  //大小端转换
+    ip_out(buf, connect->ip, NET_PROTOCOL_TCP);
+    if (flags.syn || flags.fin) {
+        connect->next_seq += 1;
+    }
+    //发出的报文都捎带了ack，待发送的延迟ack可以取消
+    if (flags.ack) {
+        connect->ack_sent = connect->ack;
+        timer_del(&tcp_timers, &connect->ack_timer);
+    }
 }
 
-// dst-port -> handler
-static map_t tcp_table; //tcp_table里面放了一个dst_port的回调函数
+/**
+ * @brief 收到按序数据并且没有数据可以捎带ack时调用，决定立即确认还是延迟确认。
+ *        快速确认模式下，或者未确认的数据达到对端两个满载报文段(按对端syn中的mss)时立即发送ack，否则最多等待TCP_DELACK_MS。
+ *
+ * @param connect
+ */
+static void tcp_ack_data(tcp_connect_t* connect) {
+    if (connect->ack == connect->ack_sent)
+        return;
+    if (connect->quickack || connect->ack - connect->ack_sent >= 2 * connect->remote_mss) {
+        if (connect->quickack)
+            connect->quickack--;
+        buf_init(&txbuf, 0);
+        tcp_send(&txbuf, connect, tcp_flags_ack);
+        return;
+    }
+    if (!timer_pending(&connect->ack_timer))
+        timer_add(&tcp_timers, &connect->ack_timer, time_ms() + TCP_DELACK_MS);
+}
 
-// tcp_key_t[IP, src port, dst port] -> tcp_connect_t
+/**
+ * @brief 报文段里的fin是否可以接受：只有fin之前的负载全部交付(没有被接收窗口裁掉)时fin才按序到达。
+ *        否则忽略fin并立即确认已经收下的部分，对端会重传剩下的数据和fin
+ *
+ * @param connect
+ * @param flags 报文段的标志
+ * @param fin_seq fin的序号，即负载起始序号加上裁剪前的负载长度
+ * @return int 接受fin为1
+ */
+static int tcp_fin_acceptable(tcp_connect_t* connect, tcp_flags_t flags, uint32_t fin_seq) {
+    if (!flags.fin)
+        return 0;
+    if (connect->ack == fin_seq)
+        return 1;
+    buf_init(&txbuf, 0);
+    tcp_send(&txbuf, connect, tcp_flags_ack);
+    return 0;
+}
 
-/* Connect_table放置了一堆TCP连接，
-    KEY为[IP，src port，dst port], 即tcp_key_t，VALUE为tcp_connect_t。
-*/
-static map_t connect_table; 
+/**
+ * @brief 不满一个mss的报文段现在是否应该发出
+ *        cork时一直攒到满段；否则按Nagle算法，有未确认的数据时先攒着，等ack到达再发，nodelay时立即发送。
+ *        发送队列中剩下的数据就是最后一段并且要带上fin时总是立即发送。
+ *
+ * @param connect
+ * @param size 这一段的长度
+ * @return int
+ */
+static int tcp_nagle_ok(tcp_connect_t* connect, uint32_t size) {
+    if (size >= connect->remote_mss)
+        return 1;
+    if (connect->fin_pending && connect->next_seq - connect->unack_seq + size == connect->tx_len)
+        return 1;
+    if (connect->cork)
+        return 0;
+    return connect->nodelay || connect->next_seq == connect->unack_seq;
+}
 
 /**
- * @brief 生成一个用于 connect_table 的 key
+ * @brief 发送循环：在对端窗口允许的范围内把发送队列中未发送的数据按对端mss分段发出，
+ *        不满一段的数据按tcp_nagle_ok决定是否暂缓，应用已经关闭连接时在最后一段带上fin。
+ *        对端窗口为0并且没有在途数据时启动坚持定时器。
  *
- * @param ip
- * @param src_port
- * @param dst_port
- * @return tcp_key_t
+ * @param connect
+ * @return int 发出的报文段数
+ */
+static int tcp_output(tcp_connect_t* connect) {
+    if (connect->state != TCP_ESTABLISHED && connect->state != TCP_CLOSE_WAIT && !connect->fin_pending)
+        return 0;
+    int count = 0;
+    for (;;) {
+        uint32_t size = tcp_send_size(connect);
+        if (size != 0 && !tcp_nagle_ok(connect, size))
+            break;
+        tcp_write_to_buf(connect, &txbuf);
+        tcp_flags_t flags = tcp_flags_ack;
+        if (connect->fin_pending && connect->next_seq - connect->unack_seq == connect->tx_len) {
+            flags.fin = 1;
+            connect->fin_pending = 0;
+        }
+        if (txbuf.len == 0 && !flags.fin)
+            break;
+        tcp_send(&txbuf, connect, flags);
+        count++;
+        if (flags.fin)
+            break;
+    }
+    if (connect->remote_win == 0 && connect->next_seq == connect->unack_seq &&
+        connect->tx_len != 0 && !timer_pending(&connect->persist_timer)) {
+        timer_add(&tcp_timers, &connect->persist_timer, time_ms() + TCP_PERSIST_MIN_MS);
+    }
+    return count;
+}
+
+/**
+ * @brief 坚持定时器到期，发送一个字节的零窗口探测，然后按指数退避重新启动定时器。
+ *        探测字节不计入next_seq，对端接收时由tcp_ack_in推进。
+ *
+ * @param connect
+ * @param now 当前时间
  */
-static tcp_key_t new_tcp_key(uint8_t ip[NET_IP_LEN], uint16_t src_port, uint16_t dst_port) {
-    tcp_key_t key;
-    memcpy(key.ip, ip, NET_IP_LEN);
-    key.src_port = src_port;
-    key.dst_port = dst_port;
-    return key;
+static void tcp_persist_probe(tcp_connect_t* connect, uint64_t now) {
+    uint32_t sent = connect->next_seq - connect->unack_seq;
+    if (connect->remote_win != 0 || connect->tx_len <= sent) {
+        connect->persist_backoff = 0;
+        return;
+    }
+    buf_init(&txbuf, 1);
+    tcp_txq_copy(connect, sent, txbuf.data, 1);
+    connect->next_seq += 1;
+    tcp_send(&txbuf, connect, tcp_flags_ack);
+    connect->next_seq -= 1;
+    if ((TCP_PERSIST_MIN_MS << connect->persist_backoff) < TCP_PERSIST_MAX_MS)
+        connect->persist_backoff++;
+    timer_add(&tcp_timers, &connect->persist_timer, now + min32(TCP_PERSIST_MIN_MS << connect->persist_backoff, TCP_PERSIST_MAX_MS));
 }
 
 /**
- * @brief 初始化tcp在静态区的map
+ * @brief 处理收到的ack：根据累计确认推进unack_seq并删去发送队列中已确认的数据，然后更新对端窗口。
+ *        对端窗口重新打开时停止坚持定时器，之后由调用者调用tcp_output恢复发送。
+ *
+ * @param connect
+ * @param ack_number
+ * @param window 对端通告的窗口
+ */
+static void tcp_ack_in(tcp_connect_t* connect, uint32_t ack_number, uint16_t window) {
+    uint32_t snd_max = connect->next_seq + (connect->persist_backoff ? 1 : 0);
+    if (TCP_SEQ_LT(ack_number, connect->unack_seq) || TCP_SEQ_GT(ack_number, snd_max))
+        return;
+    if (TCP_SEQ_GT(ack_number, connect->unack_seq)) {
+        //fin占用的序号不在发送队列中
+        tcp_txq_ack(connect, min32(ack_number - connect->unack_seq, connect->tx_len));
+        connect->unack_seq = ack_number;
+        if (TCP_SEQ_GT(ack_number, connect->next_seq))
+            connect->next_seq = ack_number;
+    }
+    connect->remote_win = window;
+    if (window != 0) {
+        connect->persist_backoff = 0;
+        timer_del(&tcp_timers, &connect->persist_timer);
+    }
+}
+
+/**
+ * @brief 从外部关闭一个TCP连接, 会先发送完剩余数据再发送fin
+ *        对端已经关闭(TCP_CLOSE_WAIT)时进入LAST_ACK，否则进入FIN_WAIT_1
+ *        主动打开还没有完成握手时直接放弃连接，同时打开已经回复syn-ack时先发送rst；已经在关闭的连接什么也不做，由状态机收完最后的报文后释放，
+ *        fin没有被确认或者对端迟迟不关闭时由关闭定时器放弃连接并通知TCP_CONN_CLOSED
  *        供应用层使用
  *
+ * @param connect
+ */
+void tcp_connect_close(tcp_connect_t* connect) {
+    if (connect->state == TCP_ESTABLISHED || connect->state == TCP_CLOSE_WAIT) {
+        connect->state = connect->state == TCP_ESTABLISHED ? TCP_FIN_WAIT_1 : TCP_LAST_ACK;
+        connect->fin_pending = 1;
+        timer_add(&tcp_timers, &connect->fin_timer, time_ms() + TCP_FIN_RTO_MS);
+        tcp_output(connect);
+        return;
+    }
+    if (connect->state == TCP_SYN_SEND) {
+        release_tcp_connect(connect);
+        return;
+    }
+    //同时打开中对端已经收到我方的syn，回复rst让它也放弃
+    if (connect->state == TCP_SYN_RCVD && connect->active) {
+        buf_init(&txbuf, 0);
+        tcp_send(&txbuf, connect, tcp_flags_ack_rst);
+        release_tcp_connect(connect);
+    }
+}
+
+/**
+ * @brief 设置连接的发送选项
+ *        TCP_CONN_NODELAY：关闭Nagle算法，小段立即发送，打开时把攒下的数据立即发出；
+ *        TCP_CONN_CORK：只发送满段，取消cork时把攒下的数据立即发出。
+ *        供应用层使用
+ *
+ * @param connect
+ * @param opt
+ * @param value 非0为打开
+ */
+void tcp_connect_setopt(tcp_connect_t* connect, tcp_conn_opt_t opt, int value) {
+    switch (opt) {
+    case TCP_CONN_NODELAY:
+        connect->nodelay = value != 0;
+        if (value)
+            tcp_output(connect);
+        break;
+    case TCP_CONN_CORK:
+        connect->cork = value != 0;
+        //取消cork时攒下的不满一段的数据立即发出，这一次不受Nagle算法限制
+        if (!value) {
+            uint8_t nodelay = connect->nodelay;
+            connect->nodelay = 1;
+            tcp_output(connect);
+            connect->nodelay = nodelay;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief 借出 connect 中已按序到达、还没有被应用消费的数据，不做拷贝。
+ *        视图指向rx_buf内部，在调用tcp_connect_consume或者下一次net_poll之前有效。
+ *        供应用层使用
+ *
+ * @param connect
+ * @param data 返回数据的起始地址
+ * @return size_t 可读的字节数
+ */
+size_t tcp_connect_peek(tcp_connect_t* connect, const uint8_t** data) {
+    *data = connect->rx_buf->data;
+    return connect->rx_buf->len;
+}
+
+/**
+ * @brief 归还tcp_connect_peek借出的前len字节，这部分空间重新计入接收窗口。
+ *        供应用层使用
+ *
+ * @param connect
+ * @param len 不超过tcp_connect_peek返回的字节数
+ */
+void tcp_connect_consume(tcp_connect_t* connect, size_t len) {
+    tcp_buf_t* rx_buf = connect->rx_buf;
+    len = min32(rx_buf->len, len);
+    rx_buf->data += len;
+    rx_buf->len -= len;
+    //读空且没有乱序数据时直接回到头部，省去之后的搬移
+    if (rx_buf->len == 0 && connect->ooo_count == 0)
+        rx_buf->data = rx_buf->payload;
+
+    //通告的窗口已经小于一半而读走数据后能推进至少一个阈值时，主动发送窗口更新
+    if (len != 0 && (connect->state == TCP_ESTABLISHED || connect->state == TCP_FIN_WAIT_1 || connect->state == TCP_FIN_WAIT_2)) {
+        uint32_t adv = TCP_SEQ_GT(connect->rcv_wnd_edge, connect->ack) ? connect->rcv_wnd_edge - connect->ack : 0;
+        uint32_t free = TCP_RCV_BUF_LEN - min32(rx_buf->len, TCP_RCV_BUF_LEN);
+        if (adv <= TCP_RCV_BUF_LEN / 2 && free >= adv + min32(TCP_RCV_BUF_LEN / 2, TCP_MSS)) {
+            buf_init(&txbuf, 0);
+            tcp_send(&txbuf, connect, tcp_flags_ack);
+        }
+    }
+}
+
+/**
+ * @brief 从 connect 中读取数据到 buf，返回成功的字节数。
+ *        供应用层使用
+ *
+ * @param connect
+ * @param data
+ * @param len
+ * @return size_t
+ */
+size_t tcp_connect_read(tcp_connect_t* connect, uint8_t* data, size_t len) {
+    const uint8_t* view;
+    size_t size = min32(tcp_connect_peek(connect, &view), len);
+    memcpy(data, view, size);
+    tcp_connect_consume(connect, size);
+    return size;
+}
+
+/**
+ * @brief 连接是否还能写入新的数据：已经建立或者对端已经关闭的连接可以继续发送，
+ *        握手中的连接先排队，建立后发出；应用调用tcp_connect_close之后不能再写
+ *
+ * @param connect
+ * @return int
  */
-void tcp_init() {
-    map_init(&tcp_table, sizeof(uint16_t), sizeof(tcp_handler_t), 0, 0, NULL);
-    map_init(&connect_table, sizeof(tcp_key_t), sizeof(tcp_connect_t), 0, 0, NULL);
-    net_add_protocol(NET_PROTOCOL_TCP, tcp_in);
+static int tcp_can_write(tcp_connect_t* connect) {
+    if (connect->fin_pending)
+        return 0;
+    return connect->state == TCP_ESTABLISHED || connect->state == TCP_CLOSE_WAIT ||
+           connect->state == TCP_SYN_SEND || connect->state == TCP_SYN_RCVD;
 }
 
 /**
- * @brief 向 port 注册一个 TCP 连接以及关联的回调函数
+ * @brief 往connect的tx_buf里面写东西并尝试发送，返回成功的字节数，tx_buf或发送队列满时返回0。
+ *        连接已经关闭时不写入，返回0。
+ *        实际发送多少由tcp_output根据对端窗口决定。没有全部写入时，腾出空间后会通知TCP_CONN_DATA_SENT。
  *        供应用层使用
  *
- * @param port
- * @param handler
- * @return int
+ * @param connect
+ * @param data
+ * @param len
  */
-int tcp_open(uint16_t port, tcp_handler_t handler) {
-    printf("tcp open\n");
-    return map_set(&tcp_table, &port, &handler);
+size_t tcp_connect_write(tcp_connect_t* connect, const uint8_t* data, size_t len) {
+    tcp_buf_t* tx_buf = connect->tx_buf;
+    if (!tcp_can_write(connect))
+        return 0;
+
+    //紧接在拷贝数据之后的写入并入最后一段，否则要占用新的一段
+    tcp_tx_chunk_t* last = connect->txq_count ? tcp_txq_at(connect, connect->txq_count - 1) : NULL;
+    if ((last == NULL || last->zbuf != NULL) && connect->txq_count == TCP_TXQ_LEN) {
+        connect->want_write = 1;
+        return 0;
+    }
+
+    //尾部空间不够时把数据移动回头部
+    if (tx_buf->data + tx_buf->len + len > tx_buf->payload + tx_buf->size) {
+        memmove(tx_buf->payload, tx_buf->data, tx_buf->len);
+        tx_buf->data = tx_buf->payload;
+    }
+    uint8_t* dst = tx_buf->data + tx_buf->len;
+    size_t size = min32(tx_buf->payload + tx_buf->size - dst, len);
+    if (size < len)
+        connect->want_write = 1;
+    if (size == 0)
+        return 0;
+    tx_buf->len += size;
+    memcpy(dst, data, size);
+
+    if (last == NULL || last->zbuf != NULL) {
+        last = tcp_txq_at(connect, connect->txq_count++);
+        last->zbuf = NULL;
+        last->off = 0;
+        last->len = 0;
+    }
+    last->len += size;
+    connect->tx_len += size;
+    tcp_output(connect);
+    return size;
 }
 
 /**
- * @brief 完成了缓存分配工作，状态也会切换为TCP_SYN_RCVD
- *        rx_buf和tx_buf在触及边界时会把数据重新移动到头部，防止溢出。
+ * @brief 零拷贝发送zbuf中从off开始的len字节。协议栈持有zbuf的一个引用直到这些数据全部被确认，
+ *        发送时数据从应用的缓存直接拷进报文，不经过tx_buf。
+ *        供应用层使用
  *
  * @param connect
+ * @param zbuf
+ * @param off
+ * @param len
+ * @return int 成功为0，发送队列已满为-1，此时腾出空间后会通知TCP_CONN_DATA_SENT；
+ *             连接已经关闭或者区间超出zbuf、超出发送队列32位的偏移和长度时也为-1
  */
-static void init_tcp_connect_rcvd(tcp_connect_t* connect) {
-    if (connect->state == TCP_LISTEN) {
-        connect->rx_buf = malloc(sizeof(buf_t));
-        connect->tx_buf = malloc(sizeof(buf_t));
+int tcp_connect_write_zbuf(tcp_connect_t* connect, tcp_zbuf_t* zbuf, size_t off, size_t len) {
+    if (!tcp_can_write(connect))
+        return -1;
+    if (off > zbuf->len || len > zbuf->len - off)
+        return -1;
+    if (off + len > UINT32_MAX || len > UINT32_MAX - connect->tx_len)
+        return -1;
+    if (connect->txq_count == TCP_TXQ_LEN) {
+        connect->want_write = 1;
+        return -1;
     }
-    buf_init(connect->rx_buf, 0);
-    buf_init(connect->tx_buf, 0);
-    connect->state = TCP_SYN_RCVD;
+    if (len == 0)
+        return 0;
+    tcp_tx_chunk_t* chunk = tcp_txq_at(connect, connect->txq_count++);
+    tcp_zbuf_get(zbuf);
+    chunk->zbuf = zbuf;
+    chunk->off = off;
+    chunk->len = len;
+    connect->tx_len += len;
+    tcp_output(connect);
+    return 0;
 }
 
 /**
- * @brief 释放TCP连接，这会释放分配的空间，并把状态变回LISTEN。
- *        一般这个后边都会跟个map_delete(&connect_table, &key)把状态变回CLOSED
+ * @brief 监听端口收到syn。半连接没有超过上限时分配连接并进入SYN_RCVD，
+ *        否则回复以syn cookie为初始序号的syn-ack，不保存任何状态。
  *
- * @param connect
+ * @param listener
+ * @param hdr 收到的tcp头
+ * @param src_ip
+ * @param tw 被这个syn提前复用的TIME_WAIT记录，没有则为NULL
  */
-static void release_tcp_connect(tcp_connect_t* connect) {
-    if (connect->state == TCP_LISTEN)
+static void tcp_syn_in(tcp_listener_t* listener, tcp_hdr_t* hdr, uint8_t* src_ip, tcp_tw_t* tw) {
+    uint16_t src_port = swap16(hdr->src_port16);
+    uint16_t dst_port = swap16(hdr->dst_port16);
+    uint32_t seq_number = swap32(hdr->seq_number32);
+    uint16_t mss = tcp_parse_mss(hdr);
+    tcp_connect_t* connect = half_open < TCP_MAX_HALF_OPEN ? new_tcp_connect_rcvd() : NULL;
+
+    if (connect == NULL) {
+        //cookie的序号越不过TIME_WAIT中旧连接的序号，丢弃syn，等对端重传时再复用；
+        //cookie也编码不了比表中最小一项还小的mss，按更大的mss发送会超出对端的接收能力，同样等对端重传
+        if (tw != NULL || mss < cookie_mss_table[0])
+            return;
+        tcp_connect_t cookie = CONNECT_LISTEN;
+        cookie.local_port = dst_port;
+        cookie.remote_port = src_port;
+        memcpy(cookie.ip, src_ip, NET_IP_LEN);
+        cookie.next_seq = tcp_cookie_make(src_ip, src_port, dst_port, seq_number, mss);
+        cookie.ack = seq_number + 1;
+        buf_init(&txbuf, 0);
+        tcp_send(&txbuf, &cookie, tcp_flags_ack_syn);
         return;
-    free(connect->rx_buf);
-    free(connect->tx_buf);
-    connect->state = TCP_LISTEN;
-}
+    }
 
-static uint16_t tcp_checksum(buf_t* buf, uint8_t* src_ip, uint8_t* dst_ip) {
-    uint16_t len = (uint16_t)buf->len;
-    tcp_peso_hdr_t* peso_hdr = (tcp_peso_hdr_t*)(buf->data - sizeof(tcp_peso_hdr_t));
-    tcp_peso_hdr_t pre; //暂存被覆盖的IP头
-    memcpy(&pre, peso_hdr, sizeof(tcp_peso_hdr_t));
-    memcpy(peso_hdr->src_ip, src_ip, NET_IP_LEN);
-    memcpy(peso_hdr->dst_ip, dst_ip, NET_IP_LEN);
-    peso_hdr->placeholder = 0;
-    peso_hdr->protocol = NET_PROTOCOL_TCP;
-    peso_hdr->total_len16 = swap16(len);
-    uint16_t checksum = checksum16((uint16_t*)peso_hdr, len + sizeof(tcp_peso_hdr_t));
-    memcpy(peso_hdr, &pre, sizeof(tcp_peso_hdr_t));
-    return checksum;
-}
+    connect->local_port = dst_port;  //本地端口
+    connect->remote_port = src_port;  //远程端口
+    memcpy(connect->ip, src_ip, NET_IP_LEN);
+    connect->handler = listener->handler;
+    tcp_hash_insert(connect);
+    half_open++;
 
-static _Thread_local uint16_t delete_port;
+    //新连接的初始序号要越过旧连接可能还在途的报文
+    uint32_t isn = tcp_new_isn(src_ip, src_port, dst_port);
+    if (tw != NULL) {
+        if (TCP_SEQ_LT(isn, tw->snd_nxt + TCP_MAX_WINDOW + 2))
+            isn = tw->snd_nxt + TCP_MAX_WINDOW + 2;
+        tcp_tw_remove(tw);
+    }
+
+    connect->unack_seq = isn;
+    connect->next_seq = connect->unack_seq;
+    connect->ack = seq_number + 1;
+    connect->rcv_wnd_edge = connect->ack;
+    connect->ack_sent = connect->ack;
+    connect->remote_win = swap16(hdr->window_size16);
+    connect->remote_mss = mss;
+    buf_init(&txbuf, 0);
+    tcp_send(&txbuf, connect, tcp_flags_ack_syn);  //第二次握手
+    timer_add(&tcp_timers, &connect->syn_timer, time_ms() + TCP_SYN_RTO_MS);
+}
 
 /**
- * @brief tcp_close使用这个函数来查找可以关闭的连接，使用thread-local变量delete_port传递端口号。
+ * @brief 连接进入TIME_WAIT：用一条精简的记录代替连接，释放连接和收发缓存，2MSL后删除记录。
+ *        记录池用满时直接关闭连接。
  *
- * @param key,value,timestamp
+ * @param connect 已经确认了对端fin的连接
  */
-static void close_port_fn(void* key, void* value, time_t* timestamp) {
-    tcp_key_t* tcp_key = key;
-    tcp_connect_t* connect = value;
-    if (tcp_key->dst_port == delete_port) {
-        release_tcp_connect(connect);
+static void tcp_time_wait(tcp_connect_t* connect) {
+    tcp_tw_t* tw = pool_alloc(&tw_pool);
+    if (tw != NULL) {
+        memcpy(tw->ip, connect->ip, NET_IP_LEN);
+        tw->local_port = connect->local_port;
+        tw->remote_port = connect->remote_port;
+        tw->snd_nxt = connect->next_seq;
+        tw->rcv_nxt = connect->ack;
+        tcp_tw_t** bucket = &tw_table[tcp_hash(tw->ip, tw->remote_port, tw->local_port) & (TCP_HASH_SIZE - 1)];
+        tw->hash_next = *bucket;
+        *bucket = tw;
+        timer_node_init(&tw->timer, tcp_tw_timer);
+        timer_add(&tcp_timers, &tw->timer, time_ms() + TCP_TIME_WAIT_MS);
     }
+    release_tcp_connect(connect);
 }
 
 /**
- * @brief 关闭 port 上的 TCP 连接
- *        供应用层使用
+ * @brief TIME_WAIT中的四元组收到报文。rst按RFC 1337忽略；
+ *        对端重传的fin说明最后的ack丢失，重发ack并重新计时；其他带数据或syn的报文回复ack。
  *
- * @param port
+ * @param tw
+ * @param flags
+ * @param len 负载长度
  */
-void tcp_close(uint16_t port) {
-    delete_port = port;
-    map_foreach(&connect_table, close_port_fn);
-    map_delete(&tcp_table, &port);
+static void tcp_tw_in(tcp_tw_t* tw, tcp_flags_t flags, size_t len) {
+    if (flags.rst)
+        return;
+    if (flags.fin)
+        timer_add(&tcp_timers, &tw->timer, time_ms() + TCP_TIME_WAIT_MS);
+    if (!flags.fin && !flags.syn && len == 0)
+        return;
+    tcp_connect_t reply = CONNECT_LISTEN;
+    memcpy(reply.ip, tw->ip, NET_IP_LEN);
+    reply.local_port = tw->local_port;
+    reply.remote_port = tw->remote_port;
+    reply.next_seq = tw->snd_nxt;
+    reply.ack = tw->rcv_nxt;
+    buf_init(&txbuf, 0);
+    tcp_send(&txbuf, &reply, tcp_flags_ack);
 }
 
 /**
- * @brief 从 buf 中读取数据到 connect->rx_buf
+ * @brief 没有对应连接的ack可能是syn cookie的第三次握手，校验通过后直接建立ESTABLISHED连接
  *
- * @param connect
- * @param buf
- * @return uint16_t 字节数
+ * @param listener
+ * @param hdr 收到的tcp头
+ * @param src_ip
+ * @return tcp_connect_t* 新建立的连接，cookie无效或连接池已空时为NULL
  */
-static uint16_t tcp_read_from_buf(tcp_connect_t* connect, buf_t* buf) {
-    uint8_t* dst = connect->rx_buf->data + connect->rx_buf->len;
-    buf_add_padding(connect->rx_buf, buf->len);
-    memcpy(dst, buf->data, buf->len);
-    connect->ack += buf->len;
-    return buf->len;
+static tcp_connect_t* tcp_cookie_in(tcp_listener_t* listener, tcp_hdr_t* hdr, uint8_t* src_ip) {
+    uint16_t src_port = swap16(hdr->src_port16);
+    uint16_t dst_port = swap16(hdr->dst_port16);
+    uint32_t seq_number = swap32(hdr->seq_number32);
+    uint32_t ack_number = swap32(hdr->ack_number32);
+    uint16_t mss = tcp_cookie_check(src_ip, src_port, dst_port, seq_number - 1, ack_number - 1);
+    if (mss == 0)
+        return NULL;
+    tcp_connect_t* connect = new_tcp_connect_rcvd();
+    if (connect == NULL)
+        return NULL;
+
+    connect->local_port = dst_port;
+    connect->remote_port = src_port;
+    memcpy(connect->ip, src_ip, NET_IP_LEN);
+    connect->handler = listener->handler;
+    tcp_hash_insert(connect);
+
+    connect->unack_seq = ack_number;
+    connect->next_seq = ack_number;
+    connect->ack = seq_number;
+    connect->rcv_wnd_edge = connect->ack + TCP_RCV_BUF_LEN;  //syn-ack中按空缓存通告的窗口
+    connect->ack_sent = connect->ack;
+    connect->remote_win = swap16(hdr->window_size16);
+    connect->remote_mss = mss;
+    connect->state = TCP_ESTABLISHED;
+    tcp_established(connect);
+    return connect;
 }
 
 /**
- * @brief 把connect内tx_buf的数据写入到buf里面供tcp_send使用，buf原来的内容会无效。
+ * @brief 为主动打开分配本地端口：按RFC 6056从四元组哈希决定的位置开始依次尝试，
+ *        跳过监听端口以及连接表、TIME_WAIT表中已经在用的四元组。
  *
- * @param connect
- * @param buf
- * @return uint16_t 字节数
+ * @param ip 远端ip
+ * @param port 远端端口
+ * @return uint16_t 没有可用端口时为0
  */
-static uint16_t tcp_write_to_buf(tcp_connect_t* connect, buf_t* buf) {
-    uint16_t sent = connect->next_seq - connect->unack_seq;
-    uint16_t size = min32(connect->tx_buf->len - sent, connect->remote_win);
-    buf_init(buf, size);
-    memcpy(buf->data, connect->tx_buf->data + sent, size);
-    connect->next_seq += size;
-    return size;
+static uint16_t tcp_ephemeral_port(const uint8_t* ip, uint16_t port) {
+    uint32_t range = TCP_EPHEMERAL_MAX - TCP_EPHEMERAL_MIN + 1;
+    uint32_t offset = tcp_keyed_hash(isn_secret, ip, port, 0, 0, 1);
+    for (uint32_t i = 0; i < range; i++) {
+        uint16_t local_port = TCP_EPHEMERAL_MIN + (offset + ephemeral_next++) % range;
+        if (tcp_listener_get(local_port) == NULL && tcp_lookup(ip, port, local_port) == NULL &&
+            tcp_tw_lookup(ip, port, local_port) == NULL)
+            return local_port;
+    }
+    return 0;
 }
 
 /**
- * @brief 发送TCP包, seq_number32 = connect->next_seq - buf->len
- *        buf里的数据将作为负载，加上tcp头发送出去。如果flags包含syn或fin，seq会递增。
+ * @brief 主动打开一个到 ip:port 的连接，发送syn后进入SYN_SEND。
+ *        连接建立后通过handler通知TCP_CONN_CONNECTED，被拒绝或syn重传超过次数时通知TCP_CONN_CLOSED并释放连接。
+ *        供应用层使用
  *
- * @param buf
- * @param connect
- * @param flags
+ * @param ip
+ * @param port
+ * @param handler
+ * @return tcp_connect_t* 连接池已空或没有可用的本地端口时为NULL
  */
-static void tcp_send(buf_t* buf, tcp_connect_t* connect, tcp_flags_t flags) {
-    // printf("<< tcp send >> sz=%zu\n", buf->len);
-    display_flags(flags);
-    size_t prev_len = buf->len;
-    buf_add_header(buf, sizeof(tcp_hdr_t));
-    tcp_hdr_t* hdr = (tcp_hdr_t*)buf->data;
-    hdr->src_port16 = swap16(connect->local_port);
-    hdr->dst_port16 = swap16(connect->remote_port);
-    hdr->seq_number32 = swap32(connect->next_seq - prev_len);
-    hdr->ack_number32 = swap32(connect->ack);
-    hdr->data_offset = sizeof(tcp_hdr_t) / sizeof(uint32_t);
-    hdr->reserved = 0;
-    hdr->flags = flags;
-    hdr->window_size16 = swap16(connect->remote_win);
-    hdr->chunksum16 = 0;
-    hdr->urgent_pointer16 = 0;
-    hdr->chunksum16 = swap16(tcp_checksum(buf, connect->ip, net_if_ip));  //大小端转换
-    ip_out(buf, connect->ip, NET_PROTOCOL_TCP);
-    if (flags.syn || flags.fin) {
-        connect->next_seq += 1;
-    }
+tcp_connect_t* tcp_connect(const uint8_t* ip, uint16_t port, tcp_handler_t handler) {
+    uint16_t local_port = tcp_ephemeral_port(ip, port);
+    if (local_port == 0)
+        return NULL;
+    tcp_connect_t* connect = new_tcp_connect_rcvd();
+    if (connect == NULL)
+        return NULL;
+    connect->state = TCP_SYN_SEND;
+    connect->active = 1;
+    connect->local_port = local_port;
+    connect->remote_port = port;
+    memcpy(connect->ip, ip, NET_IP_LEN);
+    connect->handler = handler;
+    tcp_hash_insert(connect);
+
+    connect->unack_seq = tcp_new_isn(ip, port, local_port);
+    connect->next_seq = connect->unack_seq;
+    connect->ack = 0;
+    connect->rcv_wnd_edge = 0;
+    connect->ack_sent = 0;
+    connect->remote_win = 0;
+    connect->remote_mss = TCP_DEFAULT_MSS;
+    buf_init(&txbuf, 0);
+    tcp_send(&txbuf, connect, tcp_flags_syn);  //第一次握手
+    timer_add(&tcp_timers, &connect->syn_timer, time_ms() + TCP_SYN_RTO_MS);
+    return connect;
 }
 
 /**
- * @brief 从外部关闭一个TCP连接, 会发送剩余数据
- *        供应用层使用
+ * @brief SYN_SEND状态收到报文：确认了我方syn的syn-ack完成握手进入ESTABLISHED；
+ *        没有ack的syn是同时打开，回复syn-ack进入SYN_RCVD；确认了我方syn的rst表示连接被拒绝。
  *
  * @param connect
+ * @param hdr 收到的tcp头
  */
-void tcp_connect_close(tcp_connect_t* connect) {
-    if (connect->state == TCP_ESTABLISHED) {
-        tcp_write_to_buf(connect, &txbuf);
-        tcp_send(&txbuf, connect, tcp_flags_ack_fin);
-        connect->state = TCP_FIN_WAIT_1;
+static void tcp_syn_sent_in(tcp_connect_t* connect, tcp_hdr_t* hdr) {
+    tcp_flags_t flags = hdr->flags;
+    uint32_t seq_number = swap32(hdr->seq_number32);
+    uint32_t ack_number = swap32(hdr->ack_number32);
+
+    //确认号不对的报文来自旧连接，回复rst
+    if (flags.ack && ack_number != connect->unack_seq + 1) {
+        if (!flags.rst) {
+            tcp_connect_t reset = CONNECT_LISTEN;
+            reset.local_port = connect->local_port;
+            reset.remote_port = connect->remote_port;
+            memcpy(reset.ip, connect->ip, NET_IP_LEN);
+            reset.next_seq = ack_number;
+            buf_init(&txbuf, 0);
+            tcp_send(&txbuf, &reset, tcp_flags_rst);
+        }
         return;
     }
-    tcp_key_t key = new_tcp_key(connect->ip, connect->remote_port, connect->local_port);
-    release_tcp_connect(connect);
-    map_delete(&connect_table, &key);
+    if (flags.rst) {
+        if (flags.ack) {
+            ((tcp_handler_t)connect->handler)(connect, TCP_CONN_CLOSED);
+            release_tcp_connect(connect);
+        }
+        return;
+    }
+    if (!flags.syn)
+        return;
+
+    connect->ack = seq_number + 1;
+    connect->rcv_wnd_edge = connect->ack;
+    connect->remote_win = swap16(hdr->window_size16);
+    connect->remote_mss = tcp_parse_mss(hdr);
+
+    //同时打开
+    if (!flags.ack) {
+        connect->state = TCP_SYN_RCVD;
+        half_open++;
+        connect->next_seq = connect->unack_seq;
+        buf_init(&txbuf, 0);
+        tcp_send(&txbuf, connect, tcp_flags_ack_syn);
+        return;
+    }
+
+    connect->unack_seq += 1;
+    connect->state = TCP_ESTABLISHED;
+    timer_del(&tcp_timers, &connect->syn_timer);
+    buf_init(&txbuf, 0);
+    tcp_send(&txbuf, connect, tcp_flags_ack);  //第三次握手
+    ((tcp_handler_t)connect->handler)(connect, TCP_CONN_CONNECTED);
+    tcp_output(connect);
 }
 
 /**
- * @brief 从 connect 中读取数据到 buf，返回成功的字节数。
- *        供应用层使用
+ * @brief 确认推进、发送队列腾出空间之后调用，之前写入被截断的连接通知应用继续写
  *
  * @param connect
- * @param data
- * @param len
- * @return size_t
  */
-size_t tcp_connect_read(tcp_connect_t* connect, uint8_t* data, size_t len) {
-    buf_t* rx_buf = connect->rx_buf;
-    size_t size = min32(rx_buf->len, len);
-    memcpy(data, rx_buf->data, size);
-    if (buf_remove_header(rx_buf, size) != 0) {
-        memmove(rx_buf->payload, rx_buf->data, rx_buf->len);
-        rx_buf->data = rx_buf->payload;
-    }
-    return size;
+static void tcp_notify_writable(tcp_connect_t* connect) {
+    if (!connect->want_write || (connect->state != TCP_ESTABLISHED && connect->state != TCP_CLOSE_WAIT))
+        return;
+    connect->want_write = 0;
+    ((tcp_handler_t)connect->handler)(connect, TCP_CONN_DATA_SENT);
 }
 
 /**
- * @brief 往connect的tx_buf里面写东西，返回成功的字节数，这里要判断窗口够不够，否则图片显示不全。
- *        供应用层使用
+ * @brief 首部预测：ESTABLISHED连接上按序到达、不带选项、对端窗口不变的纯ack或纯数据报文，
+ *        直接推进发送窗口或交付数据，不走完整的状态机。其他情况返回0交给慢速路径。
  *
  * @param connect
- * @param data
- * @param len
+ * @param hdr 收到的tcp头
+ * @param buf 整个tcp报文
+ * @return int 已经处理为1
  */
-size_t tcp_connect_write(tcp_connect_t* connect, const uint8_t* data, size_t len) {
-    // printf("tcp_connect_write size: %zu\n", len);
-    buf_t* tx_buf = connect->tx_buf;
+static int tcp_fast_path(tcp_connect_t* connect, tcp_hdr_t* hdr, buf_t* buf) {
+    tcp_flags_t flags = hdr->flags;
+    if (connect->state != TCP_ESTABLISHED || hdr->data_offset != sizeof(tcp_hdr_t) / sizeof(uint32_t) ||
+        !flags.ack || flags.syn || flags.fin || flags.rst || flags.urg ||
+        swap32(hdr->seq_number32) != connect->ack || swap16(hdr->window_size16) != connect->remote_win ||
+        connect->persist_backoff || connect->fin_pending)
+        return 0;
 
-    uint8_t* dst = tx_buf->data + tx_buf->len;
-    size_t size = min32(&tx_buf->payload[BUF_MAX_LEN] - dst, len);
+    uint32_t ack_number = swap32(hdr->ack_number32);
+    size_t len = buf->len - sizeof(tcp_hdr_t);
 
-    if (connect->next_seq - connect->unack_seq + len >= connect->remote_win) {
-        return 0;
+    //纯ack：确认了新的数据，删去发送队列中已确认的部分后继续发送
+    if (len == 0) {
+        if (!TCP_SEQ_GT(ack_number, connect->unack_seq) || TCP_SEQ_GT(ack_number, connect->next_seq))
+            return 0;
+        tcp_txq_ack(connect, ack_number - connect->unack_seq);
+        connect->unack_seq = ack_number;
+        tcp_notify_writable(connect);
+        tcp_output(connect);
+        return 1;
     }
-    if (buf_add_padding(tx_buf, size) != 0) {
-        memmove(tx_buf->payload, tx_buf->data, tx_buf->len);
-        tx_buf->data = tx_buf->payload;
-        if (tcp_write_to_buf(connect, &txbuf)) {
-            tcp_send(&txbuf, connect, tcp_flags_ack);
-        }
+
+    //纯数据：没有新的确认，没有乱序数据，并且完全落在接收窗口内
+    if (ack_number != connect->unack_seq || connect->ooo_count != 0 ||
+        TCP_SEQ_GT(connect->ack + len, connect->rcv_wnd_edge))
         return 0;
+    buf_remove_header(buf, sizeof(tcp_hdr_t));
+    if (tcp_read_from_buf(connect, buf) == 0) {
+        buf_init(&txbuf, 0);
+        tcp_send(&txbuf, connect, tcp_flags_ack);
+        return 1;
     }
-    memcpy(dst, data, size);
-    return size;
+    ((tcp_handler_t)connect->handler)(connect, TCP_CONN_DATA_RECV);
+    if (tcp_output(connect) == 0)
+        tcp_ack_data(connect);
+    return 1;
 }
 
 /**
@@ -303,75 +1654,126 @@ void tcp_in(buf_t* buf, uint8_t* src_ip) {
     uint32_t ack_number = swap32(tcp->ack_number32);
     tcp_flags_t flags = tcp->flags;
 
-    //查询回调函数
-    tcp_handler_t *handler = map_get(&tcp_table, &dst_port);
-    if(handler == NULL){
+    //查询链接
+    tcp_connect_t *connect = tcp_lookup(src_ip, src_port, dst_port);
+
+    //大部分报文命中首部预测，不用走完整的状态机
+    if(connect != NULL && tcp_fast_path(connect, tcp, buf)){
         return;
     }
 
-    //查询链接
-    tcp_key_t key = new_tcp_key(src_ip, src_port, dst_port);
-    tcp_connect_t *connect = map_get(&connect_table, &key);
-
-    //链接不存在时创建一个新链接并将其状态设置为TCP_LISTEN
+    //链接不存在时由监听端口处理
     if(connect == NULL){
-        connect = (tcp_connect_t *)malloc(sizeof(tcp_connect_t));
-        connect->state = TCP_LISTEN;
-        map_set(&connect_table, &key, connect);
-    }
-    connect = map_get(&connect_table, &key);
+        tcp_listener_t *listener = tcp_listener_get(dst_port);
+
+        //处于TIME_WAIT的四元组只能被序号更大的新syn提前复用，没有时间戳选项所以只比较序号
+        tcp_tw_t *tw = tcp_tw_lookup(src_ip, src_port, dst_port);
+        if(tw != NULL && (listener == NULL || flags.syn == 0 || flags.ack == 1 || TCP_SEQ_LEQ(seq_number, tw->rcv_nxt))){
+            tcp_tw_in(tw, flags, buf->len - tcp->data_offset * sizeof(uint32_t));
+            return;
+        }
 
-    //TCP_LISTEN状态
-    if(connect->state == TCP_LISTEN){
+        if(listener == NULL){
+            return;
+        }
 
-        //服务端收到的第一个包rst有效
-        //服务端直接断开连接
+        //服务端收到的第一个包rst有效，没有需要断开的连接
         if(flags.rst == 1){
-            tcp_connect_close(connect);
+            return;
+        }
+
+        //accept队列已满，新的握手直接丢弃，不回复rst让对端稍后重试
+        if(tcp_accept_full(listener)){
+            if(flags.syn == 1){
+                listener->drops++;
+            }
+            return;
         }
 
         //服务端收到的第一个包必须是第一次握手即syn有效
-        else if(flags.syn == 0){
-            printf("!!! reset tcp !!!\n");
-            connect->next_seq = 0;
-            connect->ack = seq_number + 1;
-            buf_init(&txbuf, 0);
-            tcp_send(&txbuf, connect, tcp_flags_ack_rst);
-        }else{
-            init_tcp_connect_rcvd(connect);
-            connect->local_port = dst_port;  //本地端口
-            connect->remote_port = src_port;  //远程端口
-            memcpy(connect->ip, src_ip, NET_IP_LEN);
-
-            srand(time(NULL));
-            connect->unack_seq = rand()%(UINT16_MAX);  //选取随机数作为服务端的seq
-            connect->next_seq = connect->unack_seq;
-            connect->ack = seq_number + 1;
-            connect->remote_win = window;
+        if(flags.syn == 1){
+            if(flags.ack == 0){
+                tcp_syn_in(listener, tcp, src_ip, tw);
+            }
+            return;
+        }
+
+        //也可能是syn cookie的第三次握手，都不是则回复rst且不保存状态
+        if(flags.ack == 1){
+            connect = tcp_cookie_in(listener, tcp, src_ip);
+        }
+        if(connect == NULL){
+            LOG(LOG_TCP, LOG_DEBUG, "reset %s:%u -> %u", iptos(src_ip), src_port, dst_port);
+            tcp_connect_t reset = CONNECT_LISTEN;
+            reset.local_port = dst_port;
+            reset.remote_port = src_port;
+            memcpy(reset.ip, src_ip, NET_IP_LEN);
+            reset.next_seq = 0;
+            reset.ack = seq_number + 1;
             buf_init(&txbuf, 0);
-            tcp_send(&txbuf, connect, tcp_flags_ack_syn);  //第二次握手
+            tcp_send(&txbuf, &reset, tcp_flags_ack_rst);
+            return;
         }
+    }
+    tcp_handler_t handler = (tcp_handler_t)connect->handler;
+
+    //主动打开的连接等待第二次握手
+    if(connect->state == TCP_SYN_SEND){
+        tcp_syn_sent_in(connect, tcp);
         return;
     }
 
+    //去除TCP报头（包括选项）
+    buf_remove_header(buf, tcp->data_offset * sizeof(uint32_t));
+
+    //部分重叠的重传报文，裁掉已经收到的部分后按序处理；
+    //负载已经全部收到但fin还没有接受时(例如数据从乱序区间交付)，剩下的fin同样按序处理
+    if (TCP_SEQ_LT(seq_number, connect->ack) && (TCP_SEQ_GT(seq_number + buf->len, connect->ack) ||
+        (flags.fin == 1 && seq_number + buf->len == connect->ack))) {
+        buf_remove_header(buf, connect->ack - seq_number);
+        seq_number = connect->ack;
+    }
+
+    //fin占用负载之后的一个序号，负载可能被接收窗口裁掉一部分
+    uint32_t fin_seq = seq_number + buf->len;
+
     //检查接收到的seq_number
-    //如果与ack序号不一致则发送ack_syn复位链接
+    //不是期望的序号时，未来的数据放入乱序队列，重复的数据直接丢弃，然后回复重复ack以触发对端快速重传
     if(seq_number != connect->ack){
-        printf("!!! reset tcp !!!\n");
+        if(flags.rst == 1){
+            return;
+        }
+
+        //第二次握手丢失，对端重传了syn
+        if(connect->state == TCP_SYN_RCVD && flags.syn == 1){
+            connect->next_seq = connect->unack_seq;
+            buf_init(&txbuf, 0);
+            tcp_send(&txbuf, connect, tcp_flags_ack_syn);
+            return;
+        }
+
+        //乱序报文段里的fin不处理，等对端按序重传
+        if(TCP_SEQ_GT(seq_number, connect->ack) && buf->len != 0 &&
+            (connect->state == TCP_ESTABLISHED || connect->state == TCP_FIN_WAIT_1 || connect->state == TCP_FIN_WAIT_2)){
+            tcp_ooo_in(connect, buf, seq_number);
+        }
         buf_init(&txbuf, 0);
-        tcp_send(&txbuf, connect, tcp_flags_ack_syn);
+        tcp_send(&txbuf, connect, tcp_flags_ack);
         return;
     }
 
     //检查rst是否有效
-    //如果有则重置链接
+    //如果有则重置链接，应用已经拿到的连接先通知关闭，包括同时打开中的主动连接
     if(flags.rst == 1){
-        tcp_connect_close(connect);
+        if((connect->state != TCP_SYN_RCVD || connect->active) && !connect->accepting){
+            (*handler)(connect, TCP_CONN_CLOSED);
+        }
+        release_tcp_connect(connect);
         return;
     }
 
-    //序号相同时调用buf_remove_header去除TCP报头
-    buf_remove_header(buf, sizeof(tcp_hdr_t));
+    uint32_t recv_len = 0;
+    uint32_t unack_seq = connect->unack_seq;
 
     //进行状态转换
     switch (connect->state) {
@@ -385,14 +1787,24 @@ void tcp_in(buf_t* buf, uint8_t* src_ip) {
     case TCP_SYN_RCVD:
 
         //没有收到第三次握手继续等待
-        if(flags.ack == 0){
+        if(flags.ack == 0 || ack_number != connect->unack_seq + 1){
+            break;
+        }
+
+        //accept队列已满时丢弃第三次握手，等对端重传
+        tcp_listener_t *listener = connect->active ? NULL : tcp_listener_get(connect->local_port);
+        if(tcp_accept_full(listener)){
+            listener->drops++;
             break;
         }
 
         //收到第三次握手
         connect->unack_seq += 1;  //由于第二次握手需要消耗一个seq因此将unack + 1与next_seq同步
         connect->state = TCP_ESTABLISHED;  //完成三次握手状态转换为ESTABLISHED
-        (*handler)(connect, TCP_CONN_CONNECTED); 
+        half_open--;
+        timer_del(&tcp_timers, &connect->syn_timer);
+        tcp_established(connect);
+        tcp_output(connect);  //同时打开时握手期间写入的数据现在发出
         break;
 
     case TCP_ESTABLISHED:
@@ -402,72 +1814,145 @@ void tcp_in(buf_t* buf, uint8_t* src_ip) {
             break;
         }
 
-        //ack有效
+        //ack有效，推进发送窗口并更新对端窗口
         if(flags.ack == 1){
-
-            //判断收到的ack_number是否是在已发送但未确认的窗口内
-            //根据累计确认推进unack_seq并删去选择重传的数据
-            if(connect->unack_seq < ack_number && connect->next_seq > ack_number){
-                buf_remove_header(connect->tx_buf, ack_number - connect->unack_seq);
-                connect->unack_seq = ack_number;
-            }
+            tcp_ack_in(connect, ack_number, window);
         }
 
-        //调用tcp_read_from_buf函数，把buf放入rx_buf中
-        tcp_read_from_buf(connect, buf);
+        //调用tcp_read_from_buf函数，把buf以及接上的乱序数据放入rx_buf中
+        recv_len = tcp_read_from_buf(connect, buf);
+        flags.fin = tcp_fin_acceptable(connect, flags, fin_seq);
         buf_init(&txbuf, 0);  //初始化txbuf
 
-        //fin有效服务端将二次挥手与三次挥手合并跳过CLOSE_WAIT状态
+        //fin有效，对端不再发送数据：先把同一报文段里的数据交给应用并通知对端已关闭，
+        //发送队列里的数据照常发送，应用写完后调用tcp_connect_close，fin排在这些数据之后
         if(flags.fin == 1){
-            connect->state = TCP_LAST_ACK;
+            connect->state = TCP_CLOSE_WAIT;
             connect->ack += 1;
-            tcp_send(&txbuf, connect, tcp_flags_ack_fin);
+            (*handler)(connect, TCP_CONN_DATA_RECV);
+            if(connect->unack_seq != unack_seq){
+                tcp_notify_writable(connect);
+            }
+            tcp_output(connect);
+            if(connect->ack != connect->ack_sent){
+                buf_init(&txbuf, 0);
+                tcp_send(&txbuf, connect, tcp_flags_ack);
+            }
         }
         
         //只收到了ack有效保持ESTABLISHED状态
         else{
-            if(buf->len != 0){
+            if(recv_len != 0){
                 (*handler)(connect, TCP_CONN_DATA_RECV);
-                tcp_write_to_buf(connect, &txbuf);  //将要发送的数据写入txbuf
-                tcp_send(&txbuf, connect, tcp_flags_ack);  //将数据和ack合并发送
+            }
+
+            //确认腾出了发送缓存，通知之前没写完的应用继续写
+            if(connect->unack_seq != unack_seq){
+                tcp_notify_writable(connect);
+            }
+
+            //有数据要发送时将数据和ack合并发送，否则交给延迟ack处理
+            if(tcp_output(connect) == 0 && buf->len != 0){
+                if(recv_len != 0){
+                    tcp_ack_data(connect);
+                }else{
+                    buf_init(&txbuf, 0);
+                    tcp_send(&txbuf, connect, tcp_flags_ack);
+                }
             }
         }
         break;
 
+    //对端已经关闭，只处理ack，继续发送应用写入的数据
     case TCP_CLOSE_WAIT:
-        panic("switch TCP_CLOSE_WAIT", __LINE__);
+        if(flags.ack == 1){
+            tcp_ack_in(connect, ack_number, window);
+            if(connect->unack_seq != unack_seq){
+                tcp_notify_writable(connect);
+            }
+            tcp_output(connect);
+        }
         break;
 
     case TCP_FIN_WAIT_1:
+    case TCP_CLOSING:
+
+        //fin之前的数据可能还没有发完，继续处理ack并发送
+        if(flags.ack == 1){
+            tcp_ack_in(connect, ack_number, window);
+            tcp_output(connect);
+        }
 
-        //如果收到fin&&ack有效即第三次挥手则直接关闭链接
-        if(flags.fin == 1 && flags.ack == 1){
-            tcp_connect_close(connect);
+        //半关闭之后对端仍然可以发送数据，照常接收和确认
+        recv_len = tcp_read_from_buf(connect, buf);
+        flags.fin = tcp_fin_acceptable(connect, flags, fin_seq);
+        if(flags.fin == 1 && connect->state == TCP_FIN_WAIT_1){
+            connect->ack += 1;
+        }
+
+        //fin还没有被确认
+        if(connect->fin_pending || connect->unack_seq != connect->next_seq){
+            //同时关闭，确认对端的fin后等待我方fin的ack
+            if(flags.fin == 1 && connect->state == TCP_FIN_WAIT_1){
+                connect->state = TCP_CLOSING;
+                buf_init(&txbuf, 0);
+                tcp_send(&txbuf, connect, tcp_flags_ack);
+            }else if(recv_len != 0){
+                tcp_ack_data(connect);
+            }
+            break;
+        }
+
+        //如果收到fin&&ack有效即第三次挥手，确认后进入TIME_WAIT
+        if(flags.fin == 1 && connect->state == TCP_FIN_WAIT_1){
+            buf_init(&txbuf, 0);
+            tcp_send(&txbuf, connect, tcp_flags_ack);
+            tcp_time_wait(connect);
+        }
+
+        //同时关闭时我方fin被确认
+        else if(connect->state == TCP_CLOSING){
+            tcp_time_wait(connect);
         }
 
-        //如果只收到了ack有效即第二次挥手需要等待客户端传输数据
-        if(flags.fin == 0 && flags.ack == 1){
+        //如果只收到了ack有效即第二次挥手需要等待客户端传输数据，等待的时间有上限
+        else{
             connect->state = TCP_FIN_WAIT_2;
+            timer_add(&tcp_timers, &connect->fin_timer, time_ms() + TCP_FIN_WAIT_2_MS);
+            if(recv_len != 0){
+                tcp_ack_data(connect);
+            }
         }
         break;
 
     case TCP_FIN_WAIT_2:
 
+        recv_len = tcp_read_from_buf(connect, buf);
+        flags.fin = tcp_fin_acceptable(connect, flags, fin_seq);
+
         //收到fin有效即第三次挥手
         if(flags.fin == 1){
             connect->ack += 1;  //将ack + 1
             buf_init(&txbuf, 0);
             tcp_send(&txbuf, connect, tcp_flags_ack);  //调用tcp_send发送一个ack数据包
-            tcp_connect_close(connect);  //关闭tcp链接
+            tcp_time_wait(connect);  //进入TIME_WAIT
+        }else if(recv_len != 0){
+            //对端还在发送数据，重新计时
+            timer_add(&tcp_timers, &connect->fin_timer, time_ms() + TCP_FIN_WAIT_2_MS);
+            tcp_ack_data(connect);
         }
         break;
 
     case TCP_LAST_ACK:
 
-        //收到ack有效即第四次挥手
+        //fin之前的数据可能还没有发完，继续处理ack并发送；fin被确认即第四次挥手，释放连接
         if(flags.ack == 1){
-            (*handler)(connect, TCP_CONN_CLOSED);
-            tcp_connect_close(connect);  //关闭tcp链接
+            tcp_ack_in(connect, ack_number, window);
+            tcp_output(connect);
+            if(!connect->fin_pending && connect->unack_seq == connect->next_seq){
+                (*handler)(connect, TCP_CONN_CLOSED);
+                release_tcp_connect(connect);
+            }
         }
         break;
 
@@ -477,3 +1962,74 @@ void tcp_in(buf_t* buf, uint8_t* src_ip) {
     }
     return;
 }
+
+/**
+ * @brief 延迟ack定时器到期
+ *
+ * @param node
+ */
+static void tcp_delack_timer(timer_node_t* node) {
+    tcp_connect_t* connect = timer_entry(node, tcp_connect_t, ack_timer);
+    buf_init(&txbuf, 0);
+    tcp_send(&txbuf, connect, tcp_flags_ack);
+}
+
+/**
+ * @brief 坚持定时器到期
+ *
+ * @param node
+ */
+static void tcp_persist_timer(timer_node_t* node) {
+    tcp_persist_probe(timer_entry(node, tcp_connect_t, persist_timer), time_ms());
+}
+
+/**
+ * @brief syn或syn-ack重传定时器到期，按指数退避重传，超过次数后放弃连接，主动打开的连接通知应用关闭
+ *
+ * @param node
+ */
+static void tcp_syn_timer(timer_node_t* node) {
+    tcp_connect_t* connect = timer_entry(node, tcp_connect_t, syn_timer);
+    if (connect->syn_retries >= TCP_SYN_RETRIES) {
+        if (connect->active)
+            ((tcp_handler_t)connect->handler)(connect, TCP_CONN_CLOSED);
+        release_tcp_connect(connect);
+        return;
+    }
+    connect->syn_retries++;
+    timer_add(&tcp_timers, node, time_ms() + ((uint64_t)TCP_SYN_RTO_MS << connect->syn_retries));
+    connect->next_seq = connect->unack_seq;
+    buf_init(&txbuf, 0);
+    tcp_send(&txbuf, connect, connect->state == TCP_SYN_SEND ? tcp_flags_syn : tcp_flags_ack_syn);
+}
+
+/**
+ * @brief 关闭定时器到期。FIN_WAIT_2中对端迟迟不发送fin，或者fin重传超过次数时放弃连接并通知应用；
+ *        否则按指数退避重传：fin已经发出时从unack_seq开始重新发送发送队列剩下的数据和fin
+ *
+ * @param node
+ */
+static void tcp_fin_timer(timer_node_t* node) {
+    tcp_connect_t* connect = timer_entry(node, tcp_connect_t, fin_timer);
+    if (connect->state == TCP_FIN_WAIT_2 || connect->fin_retries >= TCP_FIN_RETRIES) {
+        LOG(LOG_TCP, LOG_DEBUG, "close timeout %s:%u -> %u", iptos(connect->ip), connect->remote_port, connect->local_port);
+        ((tcp_handler_t)connect->handler)(connect, TCP_CONN_CLOSED);
+        release_tcp_connect(connect);
+        return;
+    }
+    connect->fin_retries++;
+    timer_add(&tcp_timers, node, time_ms() + ((uint64_t)TCP_FIN_RTO_MS << connect->fin_retries));
+    if (!connect->fin_pending) {
+        connect->next_seq = connect->unack_seq;
+        connect->fin_pending = 1;
+    }
+    tcp_output(connect);
+}
+
+/**
+ * @brief 推进tcp的时间轮，处理到期的syn和syn-ack重传、延迟ack、零窗口探测、fin重传、FIN_WAIT_2超时和TIME_WAIT
+ *
+ */
+void tcp_poll() {
+    timer_wheel_run(&tcp_timers, time_ms());
+}
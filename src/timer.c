@@ -0,0 +1,147 @@
+#include <string.h>
+#include "timer.h"
+
+/**
+ * @brief 初始化时间轮
+ * 
+ * @param wheel 要初始化的时间轮
+ * @param now 当前时间(ms)
+ */
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now)
+{
+    memset(wheel, 0, sizeof(timer_wheel_t));
+    wheel->tick = now / TIMER_TICK_MS;
+}
+
+/**
+ * @brief 初始化一个未启动的定时器
+ * 
+ * @param node 
+ * @param fn 到期时调用的函数
+ */
+void timer_node_init(timer_node_t *node, timer_fn_t fn)
+{
+    node->next = NULL;
+    node->pprev = NULL;
+    node->expire = 0;
+    node->fn = fn;
+}
+
+/**
+ * @brief 按到期tick把定时器挂到对应层的槽上
+ *        距离当前tick越远放在越高的层，高层的槽在低层转完一圈时被展开到低层
+ * 
+ * @param wheel 
+ * @param node 
+ */
+static void timer_link(timer_wheel_t *wheel, timer_node_t *node)
+{
+    uint64_t expire = node->expire;
+    if (expire < wheel->tick)
+        expire = wheel->tick;
+    uint64_t delta = expire - wheel->tick;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= ((uint64_t)1 << ((level + 1) * TIMER_SLOT_BITS)))
+        level++;
+    //超出最高层范围的定时器放在最高层最远的槽，展开时会重新计算
+    if (delta >= ((uint64_t)1 << (TIMER_LEVELS * TIMER_SLOT_BITS)))
+        expire = wheel->tick + ((uint64_t)1 << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1;
+    timer_node_t **slot = &wheel->slots[level][(expire >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK];
+    node->next = *slot;
+    if (*slot)
+        (*slot)->pprev = &node->next;
+    node->pprev = slot;
+    *slot = node;
+}
+
+/**
+ * @brief 启动定时器，已经启动的定时器会先被删除
+ * 
+ * @param wheel 
+ * @param node 
+ * @param expire_ms 到期时间(ms)，不早于下一个tick触发
+ */
+void timer_add(timer_wheel_t *wheel, timer_node_t *node, uint64_t expire_ms)
+{
+    timer_del(wheel, node);
+    node->expire = (expire_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    timer_link(wheel, node);
+    wheel->count++;
+}
+
+/**
+ * @brief 停止定时器，未启动的定时器不做任何事
+ * 
+ * @param wheel 
+ * @param node 
+ */
+void timer_del(timer_wheel_t *wheel, timer_node_t *node)
+{
+    if (node->pprev == NULL)
+        return;
+    *node->pprev = node->next;
+    if (node->next)
+        node->next->pprev = node->pprev;
+    node->next = NULL;
+    node->pprev = NULL;
+    wheel->count--;
+}
+
+/**
+ * @brief 把第level层的一个槽展开到低层
+ * 
+ * @param wheel 
+ * @param level 
+ * @return int 槽的下标，为0表示这一层也转完了一圈，需要继续展开更高层
+ */
+static int timer_cascade(timer_wheel_t *wheel, int level)
+{
+    int index = (wheel->tick >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+    timer_node_t *node = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    while (node)
+    {
+        timer_node_t *next = node->next;
+        timer_link(wheel, node);
+        node = next;
+    }
+    return index;
+}
+
+/**
+ * @brief 推进时间轮到now，依次调用到期定时器的函数
+ *        回调中可以启动或删除任意定时器，包括刚到期的这个
+ * 
+ * @param wheel 
+ * @param now 当前时间(ms)
+ */
+void timer_wheel_run(timer_wheel_t *wheel, uint64_t now)
+{
+    uint64_t target = now / TIMER_TICK_MS;
+    while (wheel->tick <= target)
+    {
+        //没有定时器时直接跳到当前时间
+        if (wheel->count == 0)
+        {
+            wheel->tick = target + 1;
+            break;
+        }
+        int index = wheel->tick & TIMER_SLOT_MASK;
+        for (int level = 1; index == 0 && level < TIMER_LEVELS; level++)
+            index = timer_cascade(wheel, level);
+
+        //先把槽摘下来并推进tick，回调中重新启动的定时器不会在这一轮再次触发
+        timer_node_t **slot = &wheel->slots[0][wheel->tick & TIMER_SLOT_MASK];
+        timer_node_t *expired = *slot;
+        *slot = NULL;
+        if (expired)
+            expired->pprev = &expired;
+        wheel->tick++;
+        while (expired)
+        {
+            timer_node_t *node = expired;
+            timer_del(wheel, node);
+            node->fn(node);
+        }
+    }
+}
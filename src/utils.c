@@ -1,6 +1,10 @@
 #include "utils.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
 /**
  * @brief ip转字符串
  * 
@@ -44,6 +48,112 @@ char *timetos(time_t timestamp)
 #pragma GCC diagnostic pop
 }
 
+#ifdef TEST
+uint64_t test_time_ms; //不为0时time_ms返回它，测试直接推进时间来触发定时器
+#endif
+
+/**
+ * @brief 获取单调递增的毫秒时间，用于协议栈内部的定时器
+ * 
+ * @return uint64_t 毫秒数
+ */
+uint64_t time_ms()
+{
+#ifdef TEST
+    if (test_time_ms)
+        return test_time_ms;
+#endif
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+/**
+ * @brief 生成随机字节，用作协议栈内部哈希的密钥。优先读取/dev/urandom，失败时退化为以时间为种子的rand
+ * 
+ * @param buf 输出缓冲区
+ * @param len 字节数
+ */
+void random_bytes(uint8_t *buf, size_t len)
+{
+    FILE *f = fopen("/dev/urandom", "rb");
+    size_t got = 0;
+    if (f)
+    {
+        got = fread(buf, 1, len, f);
+        fclose(f);
+    }
+    if (got == len)
+        return;
+    srand((unsigned)time(NULL) ^ (unsigned)time_ms());
+    for (; got < len; got++)
+        buf[got] = rand() >> 7;
+}
+
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND                                                   \
+    do                                                             \
+    {                                                              \
+        v0 += v1, v1 = ROTL64(v1, 13), v1 ^= v0, v0 = ROTL64(v0, 32); \
+        v2 += v3, v3 = ROTL64(v3, 16), v3 ^= v2;                   \
+        v0 += v3, v3 = ROTL64(v3, 21), v3 ^= v0;                   \
+        v2 += v1, v1 = ROTL64(v1, 17), v1 ^= v2, v2 = ROTL64(v2, 32); \
+    } while (0)
+
+/**
+ * @brief 按小端读取8字节
+ */
+static uint64_t load64_le(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/**
+ * @brief SipHash-2-4带密钥哈希，用于tcp初始序号和syn cookie这类不能被对端预测的场合
+ * 
+ * @param key 16字节密钥
+ * @param data 要计算的数据
+ * @param len 数据长度
+ * @return uint64_t 哈希值
+ */
+uint64_t siphash24(const uint8_t key[16], const uint8_t *data, size_t len)
+{
+    uint64_t k0 = load64_le(key), k1 = load64_le(key + 8);
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+    uint64_t b = (uint64_t)len << 56;
+    const uint8_t *end = data + len - len % 8;
+    for (; data != end; data += 8)
+    {
+        uint64_t m = load64_le(data);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    for (int i = len % 8 - 1; i >= 0; i--)
+        b |= (uint64_t)data[i] << (8 * i);
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
 /**
  * @brief ip前缀匹配
  * 
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+#include "tcp_peer.h"
+#include "ip.h"
+
+//tcp测试不经过网卡和ip层：对端的报文直接交给tcp_in，tcp发出的报文在ip_out中记录下来
+uint8_t peer_ip[NET_IP_LEN] = {192, 168, 163, 10};
+uint16_t peer_win = 4096;
+uint16_t peer_mss;
+peer_seg_t out[PEER_MAX_OUT];
+int nout;
+static int failed;
+
+int driver_open() { return 0; }
+int driver_recv(buf_t *buf) { return 0; }
+int driver_send(buf_t *buf) { return 0; }
+void driver_close() {}
+void ip_in(buf_t *buf, uint8_t *src_mac) {}
+void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, uint16_t offset, int mf) {}
+void ip_init() {}
+
+void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
+{
+        tcp_hdr_t *hdr = (tcp_hdr_t *)buf->data;
+        size_t hdr_len = hdr->data_offset * sizeof(uint32_t);
+        if (nout == PEER_MAX_OUT)
+                return;
+        peer_seg_t *seg = &out[nout++];
+        seg->seq = swap32(hdr->seq_number32);
+        seg->ack = swap32(hdr->ack_number32);
+        seg->flags = hdr->flags;
+        seg->src_port = swap16(hdr->src_port16);
+        seg->dst_port = swap16(hdr->dst_port16);
+        seg->win = swap16(hdr->window_size16);
+        seg->mss = 0;
+        if (hdr_len >= sizeof(tcp_hdr_t) + 4 && buf->data[sizeof(tcp_hdr_t)] == 2)
+                seg->mss = buf->data[sizeof(tcp_hdr_t) + 2] << 8 | buf->data[sizeof(tcp_hdr_t) + 3];
+        seg->len = buf->len - hdr_len;
+        memcpy(seg->data, buf->data + hdr_len, seg->len < PEER_MAX_DATA ? seg->len : PEER_MAX_DATA);
+}
+
+/**
+ * @brief 用测试时钟初始化协议栈，之后由peer_advance推进时间
+ */
+void peer_init()
+{
+        test_time_ms = 1000000;
+        net_init();
+}
+
+/**
+ * @brief 构造一个对端发来的报文段交给tcp_in，tcp回复的报文段从out[0]开始记录
+ *
+ * @param src_port 对端端口
+ * @param dst_port 本地端口
+ * @param seq
+ * @param ack
+ * @param flags
+ * @param data 负载，可以为NULL
+ * @param len
+ */
+void peer_send(uint16_t src_port, uint16_t dst_port, uint32_t seq, uint32_t ack, tcp_flags_t flags, const void *data, size_t len)
+{
+        static buf_t buf;
+        size_t opt_len = flags.syn && peer_mss ? 4 : 0;
+        size_t tcp_len = sizeof(tcp_hdr_t) + opt_len + len;
+        buf_init(&buf, 12 + tcp_len);
+        memset(buf.data, 0, buf.len);
+        uint8_t *pseudo = buf.data;
+        tcp_hdr_t *hdr = (tcp_hdr_t *)(buf.data + 12);
+        hdr->src_port16 = swap16(src_port);
+        hdr->dst_port16 = swap16(dst_port);
+        hdr->seq_number32 = swap32(seq);
+        hdr->ack_number32 = swap32(ack);
+        hdr->data_offset = (sizeof(tcp_hdr_t) + opt_len) / 4;
+        hdr->flags = flags;
+        hdr->window_size16 = swap16(peer_win);
+        if (opt_len)
+        {
+                uint8_t *opt = (uint8_t *)(hdr + 1);
+                opt[0] = 2;
+                opt[1] = 4;
+                opt[2] = peer_mss >> 8;
+                opt[3] = peer_mss & 0xff;
+        }
+        if (len)
+                memcpy((uint8_t *)(hdr + 1) + opt_len, data, len);
+        memcpy(pseudo, peer_ip, NET_IP_LEN);
+        memcpy(pseudo + 4, net_if_ip, NET_IP_LEN);
+        pseudo[9] = NET_PROTOCOL_TCP;
+        pseudo[10] = tcp_len >> 8;
+        pseudo[11] = tcp_len & 0xff;
+        hdr->chunksum16 = swap16(checksum16((uint16_t *)buf.data, buf.len));
+        buf_remove_header(&buf, 12);
+        nout = 0;
+        tcp_in(&buf, peer_ip);
+}
+
+/**
+ * @brief 推进测试时钟并运行tcp的定时器，定时器发出的报文段从out[0]开始记录
+ *
+ * @param ms
+ */
+void peer_advance(uint64_t ms)
+{
+        nout = 0;
+        test_time_ms += ms;
+        tcp_poll();
+}
+
+void check(int ok, const char *what)
+{
+        if (!ok)
+        {
+                printf("\e[1;31mFailed: %s\n", what);
+                failed++;
+        }
+}
+
+/**
+ * @brief 打印测试结果
+ *
+ * @param name
+ * @return int main的返回值，全部通过为0
+ */
+int check_result(const char *name)
+{
+        if (failed)
+        {
+                printf("\e[1;31m%d checks failed\n\e[0m", failed);
+                return -1;
+        }
+        printf("\e[1;32mAll %s checks passed.\n\e[0m", name);
+        return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef TCP_PEER_H
+#define TCP_PEER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "net.h"
+#include "tcp.h"
+#include "utils.h"
+
+#define PEER_MAX_OUT 64        //最多记录的报文段数
+#define PEER_MAX_DATA 2048     //每个报文段最多记录的负载
+
+typedef struct peer_seg //tcp发给对端的一个报文段
+{
+        uint32_t seq, ack;
+        tcp_flags_t flags;
+        uint16_t src_port, dst_port;
+        uint16_t win;
+        uint16_t mss;          //syn中的mss选项，没有为0
+        size_t len;            //负载长度
+        uint8_t data[PEER_MAX_DATA];
+} peer_seg_t;
+
+extern uint8_t peer_ip[NET_IP_LEN];
+extern uint16_t peer_win;      //之后发出的报文段通告的窗口
+extern uint16_t peer_mss;      //之后发出的syn带的mss选项，为0时不带
+extern peer_seg_t out[PEER_MAX_OUT];
+extern int nout;
+
+void peer_init();
+void peer_send(uint16_t src_port, uint16_t dst_port, uint32_t seq, uint32_t ack, tcp_flags_t flags, const void *data, size_t len);
+void peer_advance(uint64_t ms);
+void check(int ok, const char *what);
+int check_result(const char *name);
+
+#endif
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <string.h>
+#include "http_parser.h"
+
+typedef struct parse_case
+{
+        const char *name;
+        const char *input;
+        http_parse_status_t status; //把input一次交给解析器时的结果，分段交给时必须相同
+        const char *method;         //下面几项只在HTTP_PARSE_DONE时检查
+        const char *path;
+        const char *version;
+        size_t header_count;
+        const char *host;           //Host首部的值，为NULL时不应该有这个首部
+} parse_case_t;
+
+static const parse_case_t cases[] = {
+        {"simple", "GET / HTTP/1.1\r\n\r\n", HTTP_PARSE_DONE, "GET", "/", "HTTP/1.1", 0, NULL},
+        {"headers", "GET /index.html HTTP/1.1\r\nHost: example\r\nAccept: */*\r\n\r\n",
+         HTTP_PARSE_DONE, "GET", "/index.html", "HTTP/1.1", 2, "example"},
+        {"bare lf", "HEAD /a HTTP/1.0\nHost: x\n\n", HTTP_PARSE_DONE, "HEAD", "/a", "HTTP/1.0", 1, "x"},
+        {"leading blank lines", "\r\n\r\nGET /b HTTP/1.1\r\nhost:  y \t\r\n\r\n", HTTP_PARSE_DONE, "GET", "/b", "HTTP/1.1", 1, "y"},
+        {"empty header value", "GET / HTTP/1.1\r\nHost:\r\n\r\n", HTTP_PARSE_DONE, "GET", "/", "HTTP/1.1", 1, ""},
+        {"incomplete line", "GET / HTTP/1.1", HTTP_PARSE_AGAIN},
+        {"incomplete headers", "GET / HTTP/1.1\r\nHost: a\r\n", HTTP_PARSE_AGAIN},
+        {"no version", "GET /\r\n\r\n", HTTP_PARSE_ERROR},
+        {"empty version", "GET / \r\n\r\n", HTTP_PARSE_ERROR},
+        {"leading space", " GET / HTTP/1.1\r\n\r\n", HTTP_PARSE_ERROR},
+        {"double space", "GET  / HTTP/1.1\r\n\r\n", HTTP_PARSE_ERROR},
+        {"extra token", "GET / HTTP/1.1 x\r\n\r\n", HTTP_PARSE_ERROR},
+        {"method only", "GET\r\n\r\n", HTTP_PARSE_ERROR},
+        {"header without colon", "GET / HTTP/1.1\r\nHost\r\n\r\n", HTTP_PARSE_ERROR},
+        {"header without name", "GET / HTTP/1.1\r\n: x\r\n\r\n", HTTP_PARSE_ERROR},
+        {"space before colon", "GET / HTTP/1.1\r\nHost : x\r\n\r\n", HTTP_PARSE_ERROR},
+};
+
+typedef struct range_case
+{
+        const char *name;
+        const char *input;            //Range首部的值
+        size_t size;                  //文件长度
+        int count;                    //http_parse_range的返回值
+        http_range_t ranges[HTTP_MAX_RANGES];
+} range_case_t;
+
+static const range_case_t range_cases[] = {
+        {"single", "bytes=0-9", 100, 1, {{0, 10}}},
+        {"open end", "bytes=90-", 100, 1, {{90, 10}}},
+        {"suffix", "bytes=-20", 100, 1, {{80, 20}}},
+        {"suffix longer than file", "bytes=-200", 100, 1, {{0, 100}}},
+        {"zero suffix", "bytes=-0", 100, 0},
+        {"suffix of empty file", "bytes=-5", 0, 0},
+        {"end past eof", "bytes=50-500", 100, 1, {{50, 50}}},
+        {"start at eof", "bytes=100-", 100, 0},
+        {"start past eof", "bytes=200-300", 100, 0},
+        {"range past eof skipped", "bytes=200-300, 5-6", 100, 1, {{5, 2}}},
+        {"overlapping", "bytes=0-9,5-14", 100, 2, {{0, 10}, {5, 10}}},
+        {"suffix overlapping", "bytes=0-,-10", 100, 2, {{0, 100}, {90, 10}}},
+        {"whitespace and empty items", "bytes= 0-0 , ,1-1,", 100, 2, {{0, 1}, {1, 1}}},
+        {"case insensitive unit", "BYTES=1-1", 100, 1, {{1, 1}}},
+        {"max ranges", "bytes=0-0,1-1,2-2,3-3,4-4,5-5,6-6,7-7", 100, 8,
+         {{0, 1}, {1, 1}, {2, 1}, {3, 1}, {4, 1}, {5, 1}, {6, 1}, {7, 1}}},
+        {"too many ranges", "bytes=0-0,1-1,2-2,3-3,4-4,5-5,6-6,7-7,8-8", 100, -1},
+        {"too many unsatisfiable ranges", "bytes=200-,201-,202-,203-,204-,205-,206-,207-,208-", 100, -1},
+        {"reversed", "bytes=5-2", 100, -1},
+        {"other unit", "items=0-1", 100, -1},
+        {"no ranges", "bytes=", 100, -1},
+        {"only commas", "bytes=,,", 100, -1},
+        {"not a number", "bytes=a-", 100, -1},
+        {"no dash", "bytes=5", 100, -1},
+        {"trailing garbage", "bytes=1-2x", 100, -1},
+        {"overflow", "bytes=99999999999999999999999-", 100, 0},
+};
+
+typedef struct match_case
+{
+        const char *name;
+        const char *list;  //首部的值
+        const char *value; //要匹配的标签或编码名
+        int match;
+} match_case_t;
+
+static const match_case_t etag_cases[] = {
+        {"strong", "\"abc\"", "\"abc\"", 1},
+        {"different", "\"abd\"", "\"abc\"", 0},
+        {"weak matches strong", "W/\"abc\"", "\"abc\"", 1},
+        {"lowercase w is not weak", "w/\"abc\"", "\"abc\"", 0},
+        {"unquoted", "abc", "\"abc\"", 0},
+        {"prefix", "\"ab\"", "\"abc\"", 0},
+        {"list", "\"x\", \"abc\",\"y\"", "\"abc\"", 1},
+        {"list with weak", "\"x\", W/\"abc\"", "\"abc\"", 1},
+        {"list without match", "\"x\", W/\"y\"", "\"abc\"", 0},
+        {"spaces", "  \"abc\"  ,", "\"abc\"", 1},
+        {"star", "*", "\"abc\"", 1},
+        {"empty", "", "\"abc\"", 0},
+        {"comma inside tag", "\"a,b\"", "\"a,b\"", 1},
+        {"comma inside other tag", "\"x,\"abc\"\"", "\"abc\"", 0},
+        {"unterminated", "\"abc", "\"abc\"", 0},
+};
+
+static const match_case_t coding_cases[] = {
+        {"listed", "gzip, br", "br", 1},
+        {"not listed", "gzip", "br", 0},
+        {"case insensitive", "GZIP", "gzip", 1},
+        {"q=1", "gzip;q=1", "gzip", 1},
+        {"q=0.5", "gzip;q=0.5", "gzip", 1},
+        {"q=0", "gzip;q=0", "gzip", 0},
+        {"q=0.000", "br, gzip; q=0.000", "gzip", 0},
+        {"q=0.001", "gzip;q=0.001", "gzip", 1},
+        {"Q=0", "gzip;Q=0", "gzip", 0},
+        {"q=0 with space", "gzip;q=0 , br", "gzip", 0},
+        {"other parameter", "gzip;level=0", "gzip", 1},
+        {"star", "*", "br", 1},
+        {"star q=0", "*;q=0", "br", 0},
+        {"listed beats star", "*;q=0, br", "br", 1},
+        {"refused beats star", "*, br;q=0", "br", 0},
+        {"prefix", "gzipx", "gzip", 0},
+        {"empty", "", "gzip", 0},
+};
+
+typedef struct date_case
+{
+        const char *name;
+        const char *input;
+        int status;   //http_parse_date的返回值
+        time_t t;
+} date_case_t;
+
+static const date_case_t date_cases[] = {
+        {"imf-fixdate", "Sun, 06 Nov 1994 08:49:37 GMT", 0, 784111777},
+        {"epoch", "Thu, 01 Jan 1970 00:00:00 GMT", 0, 0},
+        {"leap day", "Thu, 29 Feb 2024 12:00:00 GMT", 0, 1709208000},
+        {"rfc 850", "Sunday, 06-Nov-94 08:49:37 GMT", -1},
+        {"asctime", "Sun Nov  6 08:49:37 1994", -1},
+        {"not gmt", "Sun, 06 Nov 1994 08:49:37 UTC", -1},
+        {"bad month", "Sun, 06 Foo 1994 08:49:37 GMT", -1},
+        {"lowercase month", "Sun, 06 nov 1994 08:49:37 GMT", -1},
+        {"day 0", "Sun, 00 Nov 1994 08:49:37 GMT", -1},
+        {"day 32", "Sun, 32 Nov 1994 08:49:37 GMT", -1},
+        {"hour 24", "Sun, 06 Nov 1994 24:00:00 GMT", -1},
+        {"minute 60", "Sun, 06 Nov 1994 08:60:00 GMT", -1},
+        {"non-digit", "Sun, 06 Nov 1994 08:49:3x GMT", -1},
+        {"space in digits", "Sun,  6 Nov 1994 08:49:37 GMT", -1},
+        {"sign in digits", "Sun, +6 Nov 1994 08:49:37 GMT", -1},
+        {"wrong separator", "Sun, 06 Nov 1994 08-49-37 GMT", -1},
+        {"missing comma", "Sun  06 Nov 1994 08:49:37 GMT", -1},
+        {"truncated", "Sun, 06 Nov 1994 08:49:37 GM", -1},
+        {"trailing", "Sun, 06 Nov 1994 08:49:37 GMT ", -1},
+        {"empty", "", -1},
+};
+
+static int failed;
+
+static void check(int ok, const char *name, const char *what, size_t split)
+{
+        if (!ok)
+        {
+                printf("\e[1;31mFailed: %s: %s (split at %zu)\n", name, what, split);
+                failed++;
+        }
+}
+
+/**
+ * @brief 先把前split个字节交给解析器，再交全部数据，模拟请求分两次到达
+ *        split为0时一次交完
+ */
+static http_parse_status_t parse_split(http_req_t *req, const uint8_t *data, size_t len, size_t split)
+{
+        http_req_init(req);
+        if (split > 0)
+        {
+                http_parse_status_t status = http_req_parse(req, data, split);
+                if (status != HTTP_PARSE_AGAIN)
+                        return status;
+        }
+        return http_req_parse(req, data, len);
+}
+
+/**
+ * @brief 一次一个字节地交给解析器
+ */
+static http_parse_status_t parse_bytes(http_req_t *req, const uint8_t *data, size_t len)
+{
+        http_parse_status_t status = HTTP_PARSE_AGAIN;
+        http_req_init(req);
+        for (size_t i = 1; i <= len && status == HTTP_PARSE_AGAIN; i++)
+                status = http_req_parse(req, data, i);
+        return status;
+}
+
+static void check_req(const parse_case_t *c, const http_req_t *req, const uint8_t *data, size_t len, size_t split)
+{
+        check(req->len == len, c->name, "length", split);
+        check(http_str_eq(data, req->method, c->method), c->name, "method", split);
+        check(http_str_eq(data, req->path, c->path), c->name, "path", split);
+        check(http_str_eq(data, req->version, c->version), c->name, "version", split);
+        check(req->header_count == c->header_count, c->name, "header count", split);
+        const http_str_t *host = http_req_header(req, data, "host");
+        if (c->host == NULL)
+                check(host == NULL, c->name, "unexpected host", split);
+        else
+                check(host != NULL && http_str_eq(data, *host, c->host), c->name, "host", split);
+}
+
+/**
+ * @brief 每个用例在每个字节边界分两次交给解析器，再逐字节交一次，结果都和一次交完相同
+ */
+static void test_cases()
+{
+        http_req_t req;
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        {
+                const parse_case_t *c = &cases[i];
+                const uint8_t *data = (const uint8_t *)c->input;
+                size_t len = strlen(c->input);
+                for (size_t split = 0; split < len; split++)
+                {
+                        http_parse_status_t status = parse_split(&req, data, len, split);
+                        check(status == c->status, c->name, "status", split);
+                        if (status == HTTP_PARSE_DONE && c->status == HTTP_PARSE_DONE)
+                                check_req(c, &req, data, len, split);
+                }
+                http_parse_status_t status = parse_bytes(&req, data, len);
+                check(status == c->status, c->name, "status byte by byte", len);
+                if (status == HTTP_PARSE_DONE && c->status == HTTP_PARSE_DONE)
+                        check_req(c, &req, data, len, len);
+        }
+}
+
+/**
+ * @brief 一个缓冲区里有多个请求：解析完一个就消费它的长度，剩下的从新的起点继续解析。
+ *        缓冲区在每个字节边界被截断时，截断前的请求照常完成，被截断的请求等待更多数据
+ */
+static void test_pipeline()
+{
+        static const char *const paths[] = {"/a", "/bb", "/ccc"};
+        const char *input = "GET /a HTTP/1.1\r\nHost: h\r\n\r\n"
+                            "GET /bb HTTP/1.1\r\n\r\n"
+                            "\r\nGET /ccc HTTP/1.1\r\nConnection: close\r\n\r\n";
+        const uint8_t *data = (const uint8_t *)input;
+        size_t len = strlen(input);
+        for (size_t avail = 0; avail <= len; avail++)
+        {
+                http_req_t req;
+                size_t consumed = 0;
+                int n = 0;
+                http_req_init(&req);
+                //先给截断的数据，再在原地补齐，模拟流水线请求分两次到达
+                size_t steps[2] = {avail, len};
+                for (int s = 0; s < 2; s++)
+                {
+                        http_parse_status_t status;
+                        while ((status = http_req_parse(&req, data + consumed, steps[s] - consumed)) == HTTP_PARSE_DONE)
+                        {
+                                check(n < 3 && http_str_eq(data + consumed, req.path, paths[n]), "pipeline", "path", avail);
+                                consumed += req.len;
+                                n++;
+                                http_req_init(&req);
+                        }
+                        check(status == HTTP_PARSE_AGAIN, "pipeline", "status", avail);
+                }
+                check(n == 3 && consumed == len, "pipeline", "request count", avail);
+        }
+}
+
+/**
+ * @brief 请求头不超过HTTP_MAX_REQUEST_LEN时正常解析，超过一个字节就是错误，无论数据怎样分段到达
+ */
+static void test_overflow()
+{
+        static char input[HTTP_MAX_REQUEST_LEN + 64];
+        static const char *const head = "GET / HTTP/1.1\r\nX: ";
+        http_req_t req;
+        for (size_t total = HTTP_MAX_REQUEST_LEN - 1; total <= HTTP_MAX_REQUEST_LEN + 1; total++)
+        {
+                //首部的值用填充字符凑出总长度
+                size_t fill = total - strlen(head) - 4;
+                strcpy(input, head);
+                memset(input + strlen(head), 'x', fill);
+                strcpy(input + strlen(head) + fill, "\r\n\r\n");
+                const uint8_t *data = (const uint8_t *)input;
+                http_parse_status_t expect = total <= HTTP_MAX_REQUEST_LEN ? HTTP_PARSE_DONE : HTTP_PARSE_ERROR;
+
+                check(parse_split(&req, data, total, 0) == expect, "overflow", "status", 0);
+                check(parse_split(&req, data, total, total / 2) == expect, "overflow", "status", total / 2);
+                check(parse_split(&req, data, total, total - 1) == expect, "overflow", "status", total - 1);
+                check(parse_bytes(&req, data, total) == expect, "overflow", "status byte by byte", total);
+        }
+
+        //没有结尾的请求头攒满上限就报错，不会无限等待
+        memset(input, 'x', HTTP_MAX_REQUEST_LEN);
+        memcpy(input, head, strlen(head));
+        check(parse_split(&req, (const uint8_t *)input, HTTP_MAX_REQUEST_LEN - 1, 0) == HTTP_PARSE_AGAIN, "unterminated", "status", 0);
+        check(parse_split(&req, (const uint8_t *)input, HTTP_MAX_REQUEST_LEN, 0) == HTTP_PARSE_ERROR, "unterminated", "status", 0);
+}
+
+static void expect(int ok, const char *name, const char *what)
+{
+        if (!ok)
+        {
+                printf("\e[1;31mFailed: %s: %s\n", name, what);
+                failed++;
+        }
+}
+
+/**
+ * @brief 把字符串放在请求数据中间交给解析函数，视图的off不为0，前后的字节不属于这个值
+ */
+static http_str_t embed(char *buf, const char *value)
+{
+        strcpy(buf, "xx");
+        strcat(buf, value);
+        strcat(buf, ",x");
+        return (http_str_t){2, strlen(value)};
+}
+
+static void test_ranges()
+{
+        char buf[256];
+        for (size_t i = 0; i < sizeof(range_cases) / sizeof(range_cases[0]); i++)
+        {
+                const range_case_t *c = &range_cases[i];
+                http_range_t ranges[HTTP_MAX_RANGES];
+                http_str_t str = embed(buf, c->input);
+                int n = http_parse_range((const uint8_t *)buf, str, c->size, ranges, HTTP_MAX_RANGES);
+                expect(n == c->count, c->name, "range count");
+                for (int j = 0; j < n && n == c->count; j++)
+                        expect(ranges[j].off == c->ranges[j].off && ranges[j].len == c->ranges[j].len, c->name, "range");
+        }
+}
+
+static void test_matches(const match_case_t *cases, size_t count, int (*match)(const uint8_t *, http_str_t, const char *))
+{
+        char buf[256];
+        for (size_t i = 0; i < count; i++)
+        {
+                http_str_t str = embed(buf, cases[i].list);
+                expect(match((const uint8_t *)buf, str, cases[i].value) == cases[i].match, cases[i].name, "match");
+        }
+}
+
+static void test_dates()
+{
+        char buf[256];
+        for (size_t i = 0; i < sizeof(date_cases) / sizeof(date_cases[0]); i++)
+        {
+                const date_case_t *c = &date_cases[i];
+                time_t t;
+                http_str_t str = embed(buf, c->input);
+                int status = http_parse_date((const uint8_t *)buf, str, &t);
+                expect(status == c->status, c->name, "status");
+                if (status == 0 && c->status == 0)
+                        expect(t == c->t, c->name, "time");
+        }
+}
+
+/**
+ * @brief 完整的条件GET：If-None-Match中弱标签W/和服务器的强标签按弱比较匹配，回复304；
+ *        列表中没有匹配的标签时照常回复200
+ */
+static void test_if_none_match()
+{
+        static const struct
+        {
+                const char *name;
+                const char *request;
+                int match;
+        } cases[] = {
+                {"weak tag in list", "GET /a.html HTTP/1.1\r\nHost: h\r\nIf-None-Match: \"1-2\", W/\"5f3a-1c\"\r\n\r\n", 1},
+                {"gzip variant tag", "GET /a.js HTTP/1.1\r\nif-none-match: W/\"5f3a-1c-gzip\"\r\n\r\n", 0},
+                {"no matching tag", "GET /a.html HTTP/1.1\r\nIf-None-Match: \"5f3a-1d\", W/\"5f3a\"\r\n\r\n", 0},
+                {"star", "GET /a.html HTTP/1.1\r\nIf-None-Match: *\r\n\r\n", 1},
+        };
+        static const char *const etag = "\"5f3a-1c\""; //head_200生成的格式：修改时间和长度的十六进制
+        http_req_t req;
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        {
+                const uint8_t *data = (const uint8_t *)cases[i].request;
+                http_req_init(&req);
+                expect(http_req_parse(&req, data, strlen(cases[i].request)) == HTTP_PARSE_DONE, cases[i].name, "parse");
+                const http_str_t *inm = http_req_header(&req, data, "If-None-Match");
+                expect(inm != NULL && http_etag_match(data, *inm, etag) == cases[i].match, cases[i].name, "304");
+        }
+}
+
+int main(int argc, char *argv[])
+{
+        printf("\e[0;34mTest begin.\n");
+        test_cases();
+        test_pipeline();
+        test_overflow();
+        test_ranges();
+        test_matches(etag_cases, sizeof(etag_cases) / sizeof(etag_cases[0]), http_etag_match);
+        test_matches(coding_cases, sizeof(coding_cases) / sizeof(coding_cases[0]), http_accept_coding);
+        test_dates();
+        test_if_none_match();
+        if (failed)
+        {
+                printf("\e[1;31m%d checks failed\n\e[0m", failed);
+                return -1;
+        }
+        printf("\e[1;32mAll parser checks passed.\n\e[0m");
+        return 0;
+}
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include "faker/tcp_peer.h"
+
+#define LOCAL_PORT 80
+
+static int closed; //收到TCP_CONN_CLOSED的次数
+
+static void handler(tcp_connect_t *connect, connect_state_t state)
+{
+        if (state == TCP_CONN_CLOSED)
+                closed++;
+        //对端关闭后应用也关闭
+        if (state == TCP_CONN_DATA_RECV && connect->state == TCP_CLOSE_WAIT)
+                tcp_connect_close(connect);
+}
+
+/**
+ * @brief 和port建立一个连接并从accept队列取出
+ *
+ * @param port 对端端口
+ * @param iss 返回本地的初始序号
+ * @return tcp_connect_t*
+ */
+static tcp_connect_t *establish(uint16_t port, uint32_t *iss)
+{
+        const tcp_flags_t syn = {.syn = 1};
+        peer_send(port, LOCAL_PORT, 1000, 0, syn, NULL, 0);
+        *iss = out[0].seq;
+        peer_send(port, LOCAL_PORT, 1001, *iss + 1, tcp_flags_ack, NULL, 0);
+        return tcp_accept(LOCAL_PORT);
+}
+
+/**
+ * @brief 发出的报文段中是否有序号为seq的fin
+ */
+static int has_fin(uint32_t seq)
+{
+        for (int i = 0; i < nout; i++)
+                if (out[i].flags.fin && out[i].seq + out[i].len == seq)
+                        return 1;
+        return 0;
+}
+
+/**
+ * @brief FIN_WAIT_1中fin丢失：按指数退避重传，超过次数后释放连接并通知应用
+ */
+static void test_fin_wait_1()
+{
+        uint32_t iss;
+        tcp_connect_t *connect = establish(40001, &iss);
+        closed = 0;
+        tcp_connect_close(connect);
+        check(nout == 1 && has_fin(iss + 1), "fin sent on close");
+        uint64_t rto = TCP_FIN_RTO_MS;
+        for (int i = 0; i < TCP_FIN_RETRIES; i++)
+        {
+                peer_advance(rto - TIMER_TICK_MS);
+                check(nout == 0, "fin retransmitted early");
+                peer_advance(TIMER_TICK_MS);
+                check(nout == 1 && has_fin(iss + 1), "fin retransmitted");
+                rto *= 2;
+        }
+        check(closed == 0, "closed before retries ran out");
+        peer_advance(rto);
+        check(closed == 1 && nout == 0, "connection given up after fin retries");
+        peer_send(40001, LOCAL_PORT, 1001, iss + 2, tcp_flags_ack, NULL, 0);
+        check(nout == 1 && out[0].flags.rst, "connection released");
+}
+
+/**
+ * @brief fin之前的数据和fin都没有被确认时，重传从第一个未确认的字节开始
+ */
+static void test_fin_with_data()
+{
+        uint32_t iss;
+        tcp_connect_t *connect = establish(40002, &iss);
+        tcp_connect_setopt(connect, TCP_CONN_NODELAY, 1);
+        tcp_connect_write(connect, (const uint8_t *)"hello", 5);
+        tcp_connect_close(connect);
+        peer_advance(TCP_FIN_RTO_MS);
+        check(nout >= 1 && out[0].seq == iss + 1 && out[0].len == 5 && has_fin(iss + 6), "data and fin retransmitted");
+        //对端确认了数据和fin后不再重传
+        peer_send(40002, LOCAL_PORT, 1001, iss + 7, tcp_flags_ack, NULL, 0);
+        peer_advance(2 * TCP_FIN_RTO_MS);
+        check(nout == 0, "no retransmission after the fin is acked");
+        peer_send(40002, LOCAL_PORT, 1001, iss + 7, tcp_flags_ack_fin, NULL, 0);
+}
+
+/**
+ * @brief 对端确认了fin但一直不关闭：FIN_WAIT_2超时后释放；期间收到数据会重新计时
+ */
+static void test_fin_wait_2()
+{
+        uint32_t iss;
+        tcp_connect_t *connect = establish(40003, &iss);
+        closed = 0;
+        tcp_connect_close(connect);
+        peer_send(40003, LOCAL_PORT, 1001, iss + 2, tcp_flags_ack, NULL, 0);
+        check(connect->state == TCP_FIN_WAIT_2, "FIN_WAIT_2");
+        peer_advance(TCP_FIN_WAIT_2_MS / 2);
+        peer_send(40003, LOCAL_PORT, 1001, iss + 2, tcp_flags_ack, "x", 1);
+        peer_advance(TCP_FIN_WAIT_2_MS - TIMER_TICK_MS);
+        check(closed == 0, "FIN_WAIT_2 timer restarted by data");
+        peer_advance(TIMER_TICK_MS);
+        check(closed == 1, "FIN_WAIT_2 timed out");
+        peer_send(40003, LOCAL_PORT, 1002, iss + 2, tcp_flags_ack_fin, NULL, 0);
+        check(nout == 1 && out[0].flags.rst, "FIN_WAIT_2 connection released");
+}
+
+/**
+ * @brief LAST_ACK中最后的ack丢失：重传fin，对端确认后释放；一直没有确认时放弃
+ */
+static void test_last_ack()
+{
+        uint32_t iss;
+        establish(40004, &iss);
+        closed = 0;
+        peer_send(40004, LOCAL_PORT, 1001, iss + 1, tcp_flags_ack_fin, NULL, 0);
+        check(has_fin(iss + 1), "fin sent from CLOSE_WAIT");
+        peer_advance(TCP_FIN_RTO_MS);
+        check(nout == 1 && has_fin(iss + 1), "fin retransmitted in LAST_ACK");
+        peer_send(40004, LOCAL_PORT, 1002, iss + 2, tcp_flags_ack, NULL, 0);
+        check(closed == 1, "LAST_ACK released on the final ack");
+
+        establish(40005, &iss);
+        closed = 0;
+        peer_send(40005, LOCAL_PORT, 1001, iss + 1, tcp_flags_ack_fin, NULL, 0);
+        for (int i = 0; i <= TCP_FIN_RETRIES; i++)
+                peer_advance((uint64_t)TCP_FIN_RTO_MS << i);
+        check(closed == 1, "LAST_ACK given up");
+}
+
+/**
+ * @brief 同时关闭：CLOSING中我方fin丢失时同样重传
+ */
+static void test_closing()
+{
+        uint32_t iss;
+        tcp_connect_t *connect = establish(40006, &iss);
+        tcp_connect_close(connect);
+        peer_send(40006, LOCAL_PORT, 1001, iss + 1, tcp_flags_ack_fin, NULL, 0);
+        check(connect->state == TCP_CLOSING, "CLOSING");
+        peer_advance(TCP_FIN_RTO_MS);
+        check(nout == 1 && has_fin(iss + 1), "fin retransmitted in CLOSING");
+        peer_send(40006, LOCAL_PORT, 1002, iss + 2, tcp_flags_ack, NULL, 0);
+        peer_send(40006, LOCAL_PORT, 1001, iss + 2, tcp_flags_ack_fin, NULL, 0);
+        check(nout == 1 && out[0].flags.ack && !out[0].flags.rst, "TIME_WAIT after CLOSING");
+}
+
+/**
+ * @brief 和fin一起到达的负载被接收窗口裁掉一部分时不接受fin，只确认收下的部分；
+ *        窗口打开后对端重传剩下的数据和fin才进入CLOSE_WAIT
+ */
+static void test_fin_beyond_window()
+{
+        static uint8_t data[PEER_MAX_DATA];
+        static uint8_t sink[TCP_RCV_BUF_LEN];
+        uint32_t iss;
+        tcp_connect_t *connect = establish(40007, &iss);
+        uint32_t seq = 1001;
+        while (seq - 1001 + sizeof(data) <= TCP_RCV_BUF_LEN)
+        {
+                peer_send(40007, LOCAL_PORT, seq, iss + 1, tcp_flags_ack, data, sizeof(data));
+                seq += sizeof(data);
+        }
+        uint32_t edge = 1001 + TCP_RCV_BUF_LEN;
+        peer_send(40007, LOCAL_PORT, seq, iss + 1, tcp_flags_ack_fin, data, sizeof(data));
+        check(connect->state == TCP_ESTABLISHED, "fin beyond the window ignored");
+        check(nout >= 1 && out[nout - 1].ack == edge && out[nout - 1].win == 0, "accepted part acked");
+
+        //应用读走数据，对端从原来的序号重传，已经收下的部分被裁掉
+        tcp_connect_read(connect, sink, sizeof(sink));
+        peer_send(40007, LOCAL_PORT, seq, iss + 1, tcp_flags_ack_fin, data, sizeof(data));
+        check(connect->state == TCP_LAST_ACK, "retransmitted fin accepted");
+        check(nout >= 1 && out[nout - 1].ack == seq + sizeof(data) + 1, "retransmitted fin acked");
+        peer_send(40007, LOCAL_PORT, seq + sizeof(data) + 1, iss + 2, tcp_flags_ack, NULL, 0);
+}
+
+/**
+ * @brief FIN_WAIT_2中同样：fin之前的负载被裁掉时不进入TIME_WAIT
+ */
+static void test_fin_wait_2_beyond_window()
+{
+        static uint8_t data[PEER_MAX_DATA];
+        static uint8_t sink[TCP_RCV_BUF_LEN];
+        uint32_t iss;
+        tcp_connect_t *connect = establish(40008, &iss);
+        tcp_connect_close(connect);
+        uint32_t seq = 1001;
+        peer_send(40008, LOCAL_PORT, seq, iss + 2, tcp_flags_ack, NULL, 0);
+        while (seq - 1001 + sizeof(data) <= TCP_RCV_BUF_LEN)
+        {
+                peer_send(40008, LOCAL_PORT, seq, iss + 2, tcp_flags_ack, data, sizeof(data));
+                seq += sizeof(data);
+        }
+        peer_send(40008, LOCAL_PORT, seq, iss + 2, tcp_flags_ack_fin, data, sizeof(data));
+        check(connect->state == TCP_FIN_WAIT_2, "fin beyond the window ignored in FIN_WAIT_2");
+        check(nout == 1 && out[0].ack == 1001 + TCP_RCV_BUF_LEN, "accepted part acked in FIN_WAIT_2");
+        tcp_connect_read(connect, sink, sizeof(sink));
+        peer_send(40008, LOCAL_PORT, seq, iss + 2, tcp_flags_ack_fin, data, sizeof(data));
+        check(nout == 1 && out[0].ack == seq + sizeof(data) + 1, "retransmitted fin accepted in FIN_WAIT_2");
+}
+
+/**
+ * @brief 应用关闭连接之后不能再写入；零拷贝的区间超出发送队列32位的偏移时拒绝
+ */
+static void test_write_after_close()
+{
+        static const uint8_t data[] = "late";
+        tcp_zbuf_t zbuf;
+        uint32_t iss;
+        tcp_connect_t *connect = establish(40009, &iss);
+        //区间只记录不访问，数据指针不会被读到
+        tcp_zbuf_init(&zbuf, data, (size_t)UINT32_MAX + 16, NULL, NULL);
+        check(tcp_connect_write_zbuf(connect, &zbuf, UINT32_MAX, 8) == -1 && connect->tx_len == 0, "zbuf beyond 32 bits refused");
+        tcp_zbuf_init(&zbuf, data, sizeof(data), NULL, NULL);
+        tcp_connect_close(connect);
+        check(tcp_connect_write(connect, data, sizeof(data)) == 0, "write after close refused");
+        check(tcp_connect_write_zbuf(connect, &zbuf, 0, sizeof(data)) == -1, "zbuf write after close refused");
+        check(connect->tx_len == 0 && zbuf.ref == 1, "nothing queued after close");
+        peer_send(40009, LOCAL_PORT, 1001, iss + 2, tcp_flags_ack_fin, NULL, 0);
+}
+
+/**
+ * @brief 关闭端口：每个连接都被复位，应用已经拿到的连接收到TCP_CONN_CLOSED，之后端口上的报文都被丢弃
+ */
+static void test_close_port()
+{
+        const tcp_flags_t syn = {.syn = 1};
+        uint32_t iss, iss2;
+        establish(40010, &iss);
+        establish(40011, &iss2);
+        //握手完成但还在accept队列中，和半连接一样不通知应用
+        peer_send(40012, LOCAL_PORT, 1000, 0, syn, NULL, 0);
+        peer_send(40012, LOCAL_PORT, 1001, out[0].seq + 1, tcp_flags_ack, NULL, 0);
+        peer_send(40013, LOCAL_PORT, 1000, 0, syn, NULL, 0);
+
+        int before = closed;
+        nout = 0;
+        tcp_close(LOCAL_PORT);
+        int rst = 0;
+        for (int i = 0; i < nout; i++)
+                rst += out[i].flags.rst;
+        check(rst == 4 && nout == 4, "every connection reset");
+        check(closed - before == 2, "accepted connections notified");
+
+        peer_send(40010, LOCAL_PORT, 1001, iss + 1, tcp_flags_ack, NULL, 0);
+        check(nout == 0, "connection released");
+        peer_send(40014, LOCAL_PORT, 1000, 0, syn, NULL, 0);
+        check(nout == 0, "port no longer listening");
+}
+
+int main(int argc, char *argv[])
+{
+        printf("\e[0;34mTest begin.\n");
+        peer_init();
+        tcp_listen(LOCAL_PORT, 128, handler);
+        test_fin_wait_1();
+        test_fin_with_data();
+        test_fin_wait_2();
+        test_last_ack();
+        test_closing();
+        test_fin_beyond_window();
+        test_fin_wait_2_beyond_window();
+        test_write_after_close();
+        test_close_port();
+        return check_result("TCP close");
+}
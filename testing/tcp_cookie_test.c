@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include "faker/tcp_peer.h"
+
+#define LOCAL_PORT 80
+#define FILL_PORT 43000 //占满半连接的对端端口起点
+#define PEER_PORT 44000
+
+typedef struct mss_case
+{
+        uint16_t peer_mss; //syn中的mss选项，0为不带
+        uint16_t mss;      //握手完成后连接使用的对端mss，0表示不回复cookie
+} mss_case_t;
+
+static const mss_case_t mss_cases[] = {
+        {1460, 1460},
+        {9000, 1460},
+        {1459, 1440},
+        {1200, 1200},
+        {1000, 536},
+        {536, 536},
+        {535, 216},
+        {216, 216},
+        {215, 0},
+        {100, 0},
+        {0, TCP_DEFAULT_MSS},
+};
+
+static void handler(tcp_connect_t *connect, connect_state_t state) {}
+
+/**
+ * @brief 半连接已满时syn-ack以cookie为初始序号，不保存状态；第三次握手的ack通过校验后直接建立连接，
+ *        mss取cookie能编码的不超过对端mss的最大一项
+ */
+static void test_round_trip()
+{
+        const tcp_flags_t syn = {.syn = 1};
+        for (size_t i = 0; i < sizeof(mss_cases) / sizeof(mss_cases[0]); i++)
+        {
+                const mss_case_t *c = &mss_cases[i];
+                uint16_t port = PEER_PORT + i;
+                peer_mss = c->peer_mss;
+                peer_send(port, LOCAL_PORT, 7000, 0, syn, NULL, 0);
+                peer_mss = 0;
+                if (c->mss == 0)
+                {
+                        check(nout == 0, "syn with an mss below the cookie table dropped");
+                        continue;
+                }
+                check(nout == 1 && out[0].flags.syn && out[0].flags.ack && out[0].ack == 7001, "cookie syn-ack");
+                uint32_t cookie = out[0].seq;
+                check(tcp_accept(LOCAL_PORT) == NULL, "no state kept for a cookie");
+                peer_send(port, LOCAL_PORT, 7001, cookie + 1, tcp_flags_ack, NULL, 0);
+                tcp_connect_t *connect = tcp_accept(LOCAL_PORT);
+                check(connect != NULL && connect->state == TCP_ESTABLISHED, "cookie connection established");
+                if (connect != NULL)
+                        check(connect->remote_mss == c->mss && connect->unack_seq == cookie + 1 && connect->ack == 7001, "mss encoded in the cookie");
+        }
+}
+
+/**
+ * @brief 和cookie不符的ack、对端序号不同的ack、过期的cookie都回复rst，不建立连接
+ */
+static void test_invalid()
+{
+        const tcp_flags_t syn = {.syn = 1};
+        peer_send(PEER_PORT + 100, LOCAL_PORT, 8000, 0, syn, NULL, 0);
+        uint32_t cookie = out[0].seq;
+        peer_send(PEER_PORT + 100, LOCAL_PORT, 8001, cookie + 2, tcp_flags_ack, NULL, 0);
+        check(nout == 1 && out[0].flags.rst && tcp_accept(LOCAL_PORT) == NULL, "wrong cookie reset");
+        peer_send(PEER_PORT + 100, LOCAL_PORT, 8002, cookie + 1, tcp_flags_ack, NULL, 0);
+        check(nout == 1 && out[0].flags.rst && tcp_accept(LOCAL_PORT) == NULL, "wrong peer isn reset");
+        peer_send(PEER_PORT + 101, LOCAL_PORT, 8001, cookie + 1, tcp_flags_ack, NULL, 0);
+        check(nout == 1 && out[0].flags.rst && tcp_accept(LOCAL_PORT) == NULL, "cookie of another port reset");
+
+        //cookie在计数器前进一个周期后仍然有效，再往后过期
+        peer_send(PEER_PORT + 102, LOCAL_PORT, 9000, 0, syn, NULL, 0);
+        uint32_t old = out[0].seq;
+        peer_send(PEER_PORT + 103, LOCAL_PORT, 9000, 0, syn, NULL, 0);
+        uint32_t older = out[0].seq;
+        peer_advance(64000); //TCP_COOKIE_PERIOD_MS
+        peer_send(PEER_PORT + 102, LOCAL_PORT, 9001, old + 1, tcp_flags_ack, NULL, 0);
+        check(tcp_accept(LOCAL_PORT) != NULL, "cookie from the previous period accepted");
+        peer_advance(2 * 64000);
+        peer_send(PEER_PORT + 103, LOCAL_PORT, 9001, older + 1, tcp_flags_ack, NULL, 0);
+        check(nout == 1 && out[0].flags.rst && tcp_accept(LOCAL_PORT) == NULL, "expired cookie reset");
+}
+
+int main(int argc, char *argv[])
+{
+        const tcp_flags_t syn = {.syn = 1};
+        printf("\e[0;34mTest begin.\n");
+        peer_init();
+        tcp_listen(LOCAL_PORT, 128, handler);
+        for (int i = 0; i < TCP_MAX_HALF_OPEN; i++)
+                peer_send(FILL_PORT + i, LOCAL_PORT, 5000, 0, syn, NULL, 0);
+        test_round_trip();
+        test_invalid();
+        return check_result("TCP syn cookie");
+}
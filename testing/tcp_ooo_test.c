@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string.h>
+#include "faker/tcp_peer.h"
+
+#define LOCAL_PORT 80
+#define PEER_ISN 1000
+
+static uint8_t stream[4096]; //对端发送的字节流，第i个字节的序号是PEER_ISN + 1 + i
+
+static void handler(tcp_connect_t *connect, connect_state_t state) {}
+
+static tcp_connect_t *establish(uint16_t port, uint32_t *iss)
+{
+        const tcp_flags_t syn = {.syn = 1};
+        peer_send(port, LOCAL_PORT, PEER_ISN, 0, syn, NULL, 0);
+        *iss = out[0].seq;
+        peer_send(port, LOCAL_PORT, PEER_ISN + 1, *iss + 1, tcp_flags_ack, NULL, 0);
+        return tcp_accept(LOCAL_PORT);
+}
+
+/**
+ * @brief 对端发送字节流中[off, off + len)这一段
+ */
+static void send_range(uint16_t port, uint32_t iss, size_t off, size_t len, tcp_flags_t flags)
+{
+        peer_send(port, LOCAL_PORT, PEER_ISN + 1 + off, iss + 1, flags, stream + off, len);
+}
+
+/**
+ * @brief 应用读到的数据是否正好是字节流的前len个字节
+ */
+static int delivered(tcp_connect_t *connect, size_t len)
+{
+        const uint8_t *data;
+        size_t n = tcp_connect_peek(connect, &data);
+        return n == len && memcmp(data, stream, len) == 0;
+}
+
+/**
+ * @brief 后面的报文段先到：放进乱序区间并回复重复ack，空洞填上后一起交付并立即确认
+ */
+static void test_reorder()
+{
+        uint32_t iss;
+        tcp_connect_t *connect = establish(41001, &iss);
+        send_range(41001, iss, 300, 100, tcp_flags_ack);
+        check(nout == 1 && out[0].ack == PEER_ISN + 1, "dup ack for a hole");
+        send_range(41001, iss, 100, 100, tcp_flags_ack);
+        check(nout == 1 && out[0].ack == PEER_ISN + 1 && connect->ooo_count == 2, "two ooo ranges");
+        //和已有区间重叠、相邻的报文段合并成一个区间
+        send_range(41001, iss, 150, 200, tcp_flags_ack);
+        check(connect->ooo_count == 1 && connect->ooo[0].seq == PEER_ISN + 101 && connect->ooo[0].len == 300, "ooo ranges merged");
+        check(delivered(connect, 0), "nothing delivered before the hole is filled");
+        send_range(41001, iss, 0, 100, tcp_flags_ack);
+        check(nout == 1 && out[0].ack == PEER_ISN + 401, "ack after the hole is filled");
+        check(connect->ooo_count == 0 && delivered(connect, 400), "reassembled data delivered");
+}
+
+/**
+ * @brief 乱序区间数达到上限后新的不相邻区间被丢弃，对端重传后照常交付
+ */
+static void test_ooo_limit()
+{
+        uint32_t iss;
+        tcp_connect_t *connect = establish(41002, &iss);
+        for (int i = 1; i <= TCP_OOO_MAX_SEG + 1; i++)
+                send_range(41002, iss, i * 20, 10, tcp_flags_ack);
+        check(connect->ooo_count == TCP_OOO_MAX_SEG, "ooo ranges limited");
+        for (int i = 0; i <= TCP_OOO_MAX_SEG + 1; i++)
+                send_range(41002, iss, i * 20, 20, tcp_flags_ack);
+        check(connect->ooo_count == 0 && delivered(connect, (TCP_OOO_MAX_SEG + 2) * 20), "all data delivered after retransmission");
+}
+
+/**
+ * @brief 乱序到达的报文段超出通告窗口时丢弃
+ */
+static void test_ooo_beyond_window()
+{
+        static uint8_t big[TCP_RCV_BUF_LEN];
+        uint32_t iss;
+        tcp_connect_t *connect = establish(41003, &iss);
+        peer_send(41003, LOCAL_PORT, PEER_ISN + TCP_RCV_BUF_LEN - 10, iss + 1, tcp_flags_ack, big, 20);
+        check(connect->ooo_count == 0, "ooo segment beyond the window dropped");
+        peer_send(41003, LOCAL_PORT, PEER_ISN + TCP_RCV_BUF_LEN - 20, iss + 1, tcp_flags_ack, big, 20);
+        check(connect->ooo_count == 1, "ooo segment at the window edge kept");
+}
+
+/**
+ * @brief fin在乱序区间里：数据被缓存，fin不处理；空洞填上后仍在ESTABLISHED，对端按序重传fin后才进入CLOSE_WAIT
+ */
+static void test_ooo_fin()
+{
+        uint32_t iss;
+        tcp_connect_t *connect = establish(41004, &iss);
+        send_range(41004, iss, 100, 50, tcp_flags_ack_fin);
+        check(connect->state == TCP_ESTABLISHED && nout == 1 && out[0].ack == PEER_ISN + 1, "ooo fin not accepted");
+        check(connect->ooo_count == 1, "data before the ooo fin kept");
+        send_range(41004, iss, 0, 100, tcp_flags_ack);
+        check(connect->state == TCP_ESTABLISHED && nout == 1 && out[0].ack == PEER_ISN + 151, "hole filled, fin still missing");
+        check(delivered(connect, 150), "data delivered without the fin");
+        //对端从原来的序号重传，已经收下的数据被裁掉，剩下按序的fin
+        send_range(41004, iss, 100, 50, tcp_flags_ack_fin);
+        check(connect->state == TCP_CLOSE_WAIT && nout == 1 && out[0].ack == PEER_ISN + 152, "retransmitted fin accepted");
+}
+
+int main(int argc, char *argv[])
+{
+        printf("\e[0;34mTest begin.\n");
+        for (size_t i = 0; i < sizeof(stream); i++)
+                stream[i] = i * 7 + i / 256;
+        peer_init();
+        peer_win = UINT16_MAX;
+        tcp_listen(LOCAL_PORT, 128, handler);
+        test_reorder();
+        test_ooo_limit();
+        test_ooo_beyond_window();
+        test_ooo_fin();
+        return check_result("TCP reassembly");
+}
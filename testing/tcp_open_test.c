@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include "faker/tcp_peer.h"
+
+#define REMOTE_PORT 80
+
+static int connected; //收到TCP_CONN_CONNECTED的次数
+static int closed;    //收到TCP_CONN_CLOSED的次数
+
+static void handler(tcp_connect_t *connect, connect_state_t state)
+{
+        if (state == TCP_CONN_CONNECTED)
+                connected++;
+        if (state == TCP_CONN_CLOSED)
+                closed++;
+}
+
+/**
+ * @brief 主动打开一个连接，对端同时发来不带ack的syn，连接进入SYN_RCVD
+ *
+ * @param port 返回本地端口
+ * @param iss 返回本地的初始序号
+ * @return tcp_connect_t*
+ */
+static tcp_connect_t *simultaneous_open(uint16_t *port, uint32_t *iss)
+{
+        const tcp_flags_t syn = {.syn = 1};
+        nout = 0;
+        connected = closed = 0;
+        tcp_connect_t *connect = tcp_connect(peer_ip, REMOTE_PORT, handler);
+        check(connect != NULL && nout == 1 && out[0].flags.syn && !out[0].flags.ack, "syn sent");
+        *port = out[0].src_port;
+        *iss = out[0].seq;
+        peer_send(REMOTE_PORT, *port, 5000, 0, syn, NULL, 0);
+        check(connect->state == TCP_SYN_RCVD, "SYN_RCVD");
+        check(nout == 1 && out[0].flags.syn && out[0].flags.ack && out[0].seq == *iss && out[0].ack == 5001, "syn-ack sent");
+        return connect;
+}
+
+/**
+ * @brief 对端的syn-ack完成握手，应用收到TCP_CONN_CONNECTED，握手期间写入的数据随后发出
+ */
+static void test_established()
+{
+        uint16_t port;
+        uint32_t iss;
+        tcp_connect_t *connect = simultaneous_open(&port, &iss);
+        nout = 0;
+        check(tcp_connect_write(connect, (const uint8_t *)"hi", 2) == 2, "write during the handshake");
+        check(nout == 0, "nothing sent before the handshake completes");
+        peer_send(REMOTE_PORT, port, 5001, iss + 1, tcp_flags_ack_syn, NULL, 0);
+        check(connect->state == TCP_ESTABLISHED && connected == 1, "simultaneous open connected");
+        check(nout == 1 && out[0].seq == iss + 1 && out[0].len == 2, "queued data sent");
+        tcp_connect_close(connect);
+        peer_send(REMOTE_PORT, port, 5001, iss + 4, tcp_flags_ack_fin, NULL, 0);
+}
+
+/**
+ * @brief SYN_RCVD中收到rst：应用收到TCP_CONN_CLOSED，连接被释放
+ */
+static void test_rst()
+{
+        const tcp_flags_t rst = {.rst = 1};
+        uint16_t port;
+        uint32_t iss;
+        simultaneous_open(&port, &iss);
+        peer_send(REMOTE_PORT, port, 5001, 0, rst, NULL, 0);
+        check(closed == 1, "reset notified");
+        peer_send(REMOTE_PORT, port, 5001, iss + 1, tcp_flags_ack, NULL, 0);
+        check(nout == 0, "reset connection released");
+}
+
+/**
+ * @brief SYN_RCVD中syn-ack重传超过次数：应用收到TCP_CONN_CLOSED
+ */
+static void test_syn_timeout()
+{
+        uint16_t port;
+        uint32_t iss;
+        simultaneous_open(&port, &iss);
+        for (int i = 0; i < TCP_SYN_RETRIES; i++)
+        {
+                peer_advance((uint64_t)TCP_SYN_RTO_MS << i);
+                check(nout == 1 && out[0].flags.syn && out[0].flags.ack, "syn-ack retransmitted");
+        }
+        check(closed == 0, "closed before retries ran out");
+        peer_advance((uint64_t)TCP_SYN_RTO_MS << TCP_SYN_RETRIES);
+        check(closed == 1, "timeout notified");
+}
+
+/**
+ * @brief 应用在SYN_RCVD中关闭：回复rst并释放，不再重传syn-ack
+ */
+static void test_close()
+{
+        uint16_t port;
+        uint32_t iss;
+        tcp_connect_t *connect = simultaneous_open(&port, &iss);
+        nout = 0;
+        tcp_connect_close(connect);
+        check(nout == 1 && out[0].flags.rst && out[0].seq == iss + 1, "rst sent on close");
+        peer_advance((uint64_t)TCP_SYN_RTO_MS << TCP_SYN_RETRIES);
+        check(nout == 0 && closed == 0, "closed connection released");
+}
+
+int main(int argc, char *argv[])
+{
+        printf("\e[0;34mTest begin.\n");
+        peer_init();
+        test_established();
+        test_rst();
+        test_syn_timeout();
+        test_close();
+        return check_result("TCP open");
+}
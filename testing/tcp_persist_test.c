@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include "faker/tcp_peer.h"
+
+#define LOCAL_PORT 80
+#define PEER_PORT 42000
+
+static void handler(tcp_connect_t *connect, connect_state_t state) {}
+
+/**
+ * @brief 零窗口探测按指数退避，间隔不超过TCP_PERSIST_MAX_MS；探测字节被接收后继续探测下一个字节，
+ *        窗口打开后停止探测并发出剩下的数据
+ */
+static void test_backoff()
+{
+        const tcp_flags_t syn = {.syn = 1};
+        peer_send(PEER_PORT, LOCAL_PORT, 1000, 0, syn, NULL, 0);
+        uint32_t iss = out[0].seq;
+        peer_send(PEER_PORT, LOCAL_PORT, 1001, iss + 1, tcp_flags_ack, NULL, 0);
+        tcp_connect_t *connect = tcp_accept(LOCAL_PORT);
+        peer_win = 0;
+        peer_send(PEER_PORT, LOCAL_PORT, 1001, iss + 1, tcp_flags_ack, NULL, 0);
+        check(connect->remote_win == 0, "zero window");
+
+        nout = 0;
+        tcp_connect_write(connect, (const uint8_t *)"0123456789", 10);
+        check(nout == 0, "nothing sent into a zero window");
+        uint64_t interval = TCP_PERSIST_MIN_MS;
+        for (int i = 0; i < 12; i++)
+        {
+                peer_advance(interval - TIMER_TICK_MS);
+                check(nout == 0, "probe sent early");
+                peer_advance(TIMER_TICK_MS);
+                check(nout == 1 && out[0].seq == iss + 1 && out[0].len == 1 && out[0].data[0] == '0', "one byte probe");
+                interval = interval * 2 < TCP_PERSIST_MAX_MS ? interval * 2 : TCP_PERSIST_MAX_MS;
+        }
+        check(interval == TCP_PERSIST_MAX_MS, "backoff capped");
+
+        //对端收下了探测字节但窗口仍为0，下一次探测下一个字节
+        peer_send(PEER_PORT, LOCAL_PORT, 1001, iss + 2, tcp_flags_ack, NULL, 0);
+        check(connect->unack_seq == iss + 2 && connect->tx_len == 9, "probe byte acked");
+        peer_advance(TCP_PERSIST_MAX_MS);
+        check(nout == 1 && out[0].seq == iss + 2 && out[0].data[0] == '1', "next byte probed");
+
+        //窗口打开：停止探测，剩下的数据立即发出
+        peer_win = 4096;
+        peer_send(PEER_PORT, LOCAL_PORT, 1001, iss + 2, tcp_flags_ack, NULL, 0);
+        check(nout == 1 && out[0].seq == iss + 2 && out[0].len == 9, "data sent after the window opens");
+        check(!timer_pending(&connect->persist_timer) && connect->persist_backoff == 0, "persist timer stopped");
+        peer_advance(TCP_PERSIST_MAX_MS);
+        check(nout == 0, "no probe after the window opens");
+}
+
+/**
+ * @brief 对端窗口为0时拷贝写入的数据留在发送缓存，写满TCP_SND_BUF_LEN后拒绝；确认后腾出的空间可以继续写入
+ */
+static void test_send_buffer()
+{
+        const tcp_flags_t syn = {.syn = 1};
+        static uint8_t data[TCP_SND_BUF_LEN + 100];
+        peer_win = 4096;
+        peer_send(PEER_PORT + 1, LOCAL_PORT, 1000, 0, syn, NULL, 0);
+        uint32_t iss = out[0].seq;
+        peer_send(PEER_PORT + 1, LOCAL_PORT, 1001, iss + 1, tcp_flags_ack, NULL, 0);
+        tcp_connect_t *connect = tcp_accept(LOCAL_PORT);
+        peer_win = 0;
+        peer_send(PEER_PORT + 1, LOCAL_PORT, 1001, iss + 1, tcp_flags_ack, NULL, 0);
+
+        size_t n = tcp_connect_write(connect, data, 1000);
+        n += tcp_connect_write(connect, data, sizeof(data));
+        check(n == TCP_SND_BUF_LEN && connect->want_write, "send buffer filled");
+        check(tcp_connect_write(connect, data, 1) == 0, "write refused while full");
+
+        peer_win = 4096;
+        peer_send(PEER_PORT + 1, LOCAL_PORT, 1001, iss + 1, tcp_flags_ack, NULL, 0);
+        uint32_t sent = nout ? out[nout - 1].seq + out[nout - 1].len - (iss + 1) : 0;
+        check(sent > 0 && sent <= 4096, "data sent after the window opens");
+        peer_send(PEER_PORT + 1, LOCAL_PORT, 1001, iss + 1 + sent, tcp_flags_ack, NULL, 0);
+        check(connect->tx_len == TCP_SND_BUF_LEN - sent, "acked data removed");
+        check(tcp_connect_write(connect, data, sizeof(data)) == sent, "acked space reused");
+}
+
+int main(int argc, char *argv[])
+{
+        printf("\e[0;34mTest begin.\n");
+        peer_init();
+        tcp_listen(LOCAL_PORT, 128, handler);
+        test_backoff();
+        test_send_buffer();
+        return check_result("TCP persist");
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include "faker/tcp_peer.h"
+
+#define PEER_PORT 40000
+#define LOCAL_PORT 80
+
+static void handler(tcp_connect_t *connect, connect_state_t state) {}
+
+int main(int argc, char *argv[])
+{
+        const tcp_flags_t syn = {.syn = 1};
+        const tcp_flags_t rst = {.rst = 1};
+        printf("\e[0;34mTest begin.\n");
+        peer_init();
+        tcp_listen(LOCAL_PORT, 128, handler);
+
+        //建立连接后本地先关闭，收到对端的fin后进入TIME_WAIT
+        peer_send(PEER_PORT, LOCAL_PORT, 1000, 0, syn, NULL, 0);
+        check(nout == 1 && out[0].flags.syn && out[0].flags.ack, "syn-ack");
+        uint32_t iss = out[0].seq;
+        peer_send(PEER_PORT, LOCAL_PORT, 1001, iss + 1, tcp_flags_ack, NULL, 0);
+        tcp_connect_t *connect = tcp_accept(LOCAL_PORT);
+        check(connect != NULL, "accept");
+        if (connect == NULL)
+                return -1;
+        tcp_connect_close(connect);
+        peer_send(PEER_PORT, LOCAL_PORT, 1001, iss + 2, tcp_flags_ack_fin, NULL, 0);
+        check(nout == 1 && out[0].flags.ack && out[0].ack == 1002, "ack of the peer's fin");
+        uint32_t snd_nxt = iss + 2;
+
+        //重传的fin和序号不大于旧连接的syn都由TIME_WAIT记录回复ack
+        peer_send(PEER_PORT, LOCAL_PORT, 1001, iss + 2, tcp_flags_ack_fin, NULL, 0);
+        check(nout == 1 && !out[0].flags.syn && out[0].seq == snd_nxt && out[0].ack == 1002, "re-ack of a retransmitted fin");
+        peer_send(PEER_PORT, LOCAL_PORT, 1002, 0, syn, NULL, 0);
+        check(nout == 1 && !out[0].flags.syn && out[0].ack == 1002, "old syn answered by TIME_WAIT");
+
+        //半连接已满时复用TIME_WAIT的syn被丢弃，记录保留
+        for (int i = 0; i < TCP_MAX_HALF_OPEN; i++)
+                peer_send(PEER_PORT + 1 + i, LOCAL_PORT, 5000, 0, syn, NULL, 0);
+        peer_send(PEER_PORT, LOCAL_PORT, 90000, 0, syn, NULL, 0);
+        check(nout == 0, "reusing syn dropped while half-open queue is full");
+        peer_send(PEER_PORT, LOCAL_PORT, 1001, iss + 2, tcp_flags_ack_fin, NULL, 0);
+        check(nout == 1 && out[0].ack == 1002, "TIME_WAIT kept after a dropped syn");
+        for (int i = 0; i < TCP_MAX_HALF_OPEN; i++)
+                peer_send(PEER_PORT + 1 + i, LOCAL_PORT, 5001, 0, rst, NULL, 0);
+
+        //序号更大的syn提前复用四元组，新连接的初始序号越过旧连接的序号空间
+        peer_send(PEER_PORT, LOCAL_PORT, 90000, 0, syn, NULL, 0);
+        check(nout == 1 && out[0].flags.syn && out[0].flags.ack && out[0].ack == 90001, "syn-ack of the reused pair");
+        check(nout == 1 && (int32_t)(out[0].seq - (snd_nxt + TCP_MAX_WINDOW + 2)) >= 0, "isn of the reused pair");
+        peer_send(PEER_PORT, LOCAL_PORT, 90001, out[0].seq + 1, tcp_flags_ack, NULL, 0);
+        check(tcp_accept(LOCAL_PORT) != NULL, "accept on the reused pair");
+
+        //2MSL之后记录被删除，同一个四元组上的报文不再由TIME_WAIT回复
+        tcp_connect_t *second = tcp_accept(LOCAL_PORT);
+        check(second == NULL, "no extra connection");
+        peer_send(PEER_PORT + 100, LOCAL_PORT, 7000, 0, syn, NULL, 0);
+        iss = out[0].seq;
+        peer_send(PEER_PORT + 100, LOCAL_PORT, 7001, iss + 1, tcp_flags_ack, NULL, 0);
+        tcp_connect_close(tcp_accept(LOCAL_PORT));
+        peer_send(PEER_PORT + 100, LOCAL_PORT, 7001, iss + 2, tcp_flags_ack_fin, NULL, 0);
+        peer_advance(TCP_TIME_WAIT_MS - TIMER_TICK_MS);
+        peer_send(PEER_PORT + 100, LOCAL_PORT, 7001, iss + 2, tcp_flags_ack_fin, NULL, 0);
+        check(nout == 1 && out[0].flags.ack && !out[0].flags.rst, "TIME_WAIT restarted by a retransmitted fin");
+        peer_advance(TCP_TIME_WAIT_MS + TIMER_TICK_MS);
+        peer_send(PEER_PORT + 100, LOCAL_PORT, 7001, iss + 2, tcp_flags_ack_fin, NULL, 0);
+        check(nout == 1 && out[0].flags.rst, "TIME_WAIT expired");
+
+        return check_result("TIME_WAIT");
+}
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <string.h>
+#include "timer.h"
+
+#define TICK(ms) ((ms) / TIMER_TICK_MS)
+#define STRESS_TIMERS 512
+
+typedef struct test_timer
+{
+        timer_node_t node;
+        int fired;         //触发次数
+        uint64_t fired_at; //触发时传给timer_wheel_run的时间
+        timer_node_t *victim; //不为NULL时在回调中删除这个定时器
+        int readd;         //在回调中重新启动自己的次数
+} test_timer_t;
+
+static timer_wheel_t wheel;
+static uint64_t now;
+static int failed;
+
+static void on_timer(timer_node_t *node)
+{
+        test_timer_t *t = timer_entry(node, test_timer_t, node);
+        t->fired++;
+        t->fired_at = now;
+        if (t->victim)
+                timer_del(&wheel, t->victim);
+        if (t->readd > 0)
+        {
+                t->readd--;
+                timer_add(&wheel, node, now);
+        }
+}
+
+static void check(int ok, const char *what)
+{
+        if (!ok)
+        {
+                printf("\e[1;31mFailed: %s\n", what);
+                failed++;
+        }
+}
+
+static void run_to(uint64_t ms)
+{
+        now = ms;
+        timer_wheel_run(&wheel, now);
+}
+
+static void start(uint64_t ms)
+{
+        now = ms;
+        timer_wheel_init(&wheel, now);
+}
+
+static void arm(test_timer_t *t, uint64_t expire_ms)
+{
+        memset(t, 0, sizeof(*t));
+        timer_node_init(&t->node, on_timer);
+        timer_add(&wheel, &t->node, expire_ms);
+}
+
+/**
+ * @brief 一层内的定时器在到期tick触发，不提前
+ */
+static void test_level0()
+{
+        test_timer_t t;
+        start(1000);
+        //到期时间向上取整到tick
+        arm(&t, 1000 + 95);
+        run_to(1000 + 99);
+        check(t.fired == 0, "level 0 timer fired early");
+        run_to(1000 + 100);
+        check(t.fired == 1 && t.fired_at == 1100, "level 0 timer not fired at its tick");
+        check(wheel.count == 0, "level 0 count");
+}
+
+/**
+ * @brief 高层的定时器逐层展开，在展开过程中的每个tick都不提前触发
+ */
+static void test_cascade()
+{
+        static const uint64_t delta[] = {
+                TIMER_SLOTS,
+                TIMER_SLOTS + 1,
+                TIMER_SLOTS * TIMER_SLOTS - 1,
+                TIMER_SLOTS * TIMER_SLOTS,
+                TIMER_SLOTS * TIMER_SLOTS * 3 + TIMER_SLOTS * 5 + 7,
+        };
+        for (size_t i = 0; i < sizeof(delta) / sizeof(delta[0]); i++)
+        {
+                test_timer_t t;
+                start(0);
+                arm(&t, delta[i] * TIMER_TICK_MS);
+                uint64_t ms = 0;
+                while (TICK(ms) < delta[i] - 1)
+                {
+                        ms += TIMER_TICK_MS;
+                        run_to(ms);
+                }
+                check(t.fired == 0, "cascaded timer fired early");
+                run_to(delta[i] * TIMER_TICK_MS);
+                check(t.fired == 1, "cascaded timer not fired at its tick");
+        }
+}
+
+/**
+ * @brief 当前tick处在各层转完一圈的边界上时添加的定时器
+ */
+static void test_wraparound()
+{
+        static const uint64_t base[] = {
+                TIMER_SLOTS - 1,
+                TIMER_SLOTS * TIMER_SLOTS - 1,
+                (uint64_t)TIMER_SLOTS * TIMER_SLOTS * TIMER_SLOTS - 2,
+                ((uint64_t)1 << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1,
+        };
+        static const uint64_t delta[] = {1, 2, TIMER_SLOTS, TIMER_SLOTS + 1, TIMER_SLOTS * TIMER_SLOTS + 3};
+        for (size_t i = 0; i < sizeof(base) / sizeof(base[0]); i++)
+                for (size_t j = 0; j < sizeof(delta) / sizeof(delta[0]); j++)
+                {
+                        test_timer_t t;
+                        start(base[i] * TIMER_TICK_MS);
+                        arm(&t, (base[i] + delta[j]) * TIMER_TICK_MS);
+                        run_to((base[i] + delta[j] - 1) * TIMER_TICK_MS);
+                        check(t.fired == 0, "timer across a wrap fired early");
+                        run_to((base[i] + delta[j]) * TIMER_TICK_MS);
+                        check(t.fired == 1, "timer across a wrap not fired");
+                }
+}
+
+/**
+ * @brief 超出最高层范围的定时器先放在最远的槽，展开时重新计算，不会提前触发
+ */
+static void test_beyond_range()
+{
+        test_timer_t t;
+        uint64_t span = (uint64_t)1 << (TIMER_LEVELS * TIMER_SLOT_BITS);
+        start(0);
+        arm(&t, (span * 2 + 5) * TIMER_TICK_MS);
+        run_to((span * 2 + 4) * TIMER_TICK_MS);
+        check(t.fired == 0, "out of range timer fired early");
+        run_to((span * 2 + 5) * TIMER_TICK_MS);
+        check(t.fired == 1, "out of range timer not fired");
+}
+
+/**
+ * @brief 删除已经到期还没有回调的定时器：在run之前删除，或者被同一tick先触发的定时器删除
+ */
+static void test_del_due()
+{
+        test_timer_t a, b, c;
+        start(0);
+        arm(&a, 50);
+        arm(&b, 50);
+        arm(&c, 50);
+        a.victim = &b.node;
+        b.victim = &a.node;
+        timer_del(&wheel, &c.node);
+        check(!timer_pending(&c.node), "deleted timer still pending");
+        run_to(100);
+        check(a.fired + b.fired == 1, "timer deleted by a due sibling still fired");
+        check(c.fired == 0, "timer deleted before run fired");
+        check(wheel.count == 0, "count after deleting due timers");
+
+        //过去的时间也在下一次run时触发
+        arm(&a, 10);
+        run_to(110);
+        check(a.fired == 1, "timer in the past not fired");
+}
+
+/**
+ * @brief 回调中重新启动自己，到期时间是当前时间，在下一个tick才触发
+ */
+static void test_readd()
+{
+        test_timer_t t;
+        start(0);
+        arm(&t, 10);
+        t.readd = 2;
+        run_to(10);
+        check(t.fired == 1, "re-added timer fired in the same tick");
+        check(timer_pending(&t.node), "re-added timer not pending");
+        run_to(20);
+        run_to(30);
+        check(t.fired == 3 && !timer_pending(&t.node), "re-added timer count");
+}
+
+/**
+ * @brief 随机添加、删除定时器并以随机步长推进，和逐个比较的结果对照
+ */
+static void test_stress()
+{
+        static test_timer_t t[STRESS_TIMERS];
+        static uint64_t expect[STRESS_TIMERS]; //到期tick，为0表示已经删除或者触发
+        static int want[STRESS_TIMERS];        //应该触发的次数
+        uint32_t seed = 12345;
+#define RAND() (seed = seed * 1103515245 + 12345, seed >> 8)
+        start(123456789);
+        for (int i = 0; i < STRESS_TIMERS; i++)
+        {
+                uint64_t delta = RAND() % 4 == 0 ? RAND() % 5000000 : RAND() % 70000;
+                arm(&t[i], now + delta);
+                expect[i] = (now + delta + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+        }
+        for (int step = 0; step < 20000; step++)
+        {
+                int i = RAND() % STRESS_TIMERS;
+                if (RAND() % 8 == 0 && timer_pending(&t[i].node))
+                {
+                        timer_del(&wheel, &t[i].node);
+                        expect[i] = 0;
+                }
+                uint64_t target = now + RAND() % (step % 100 == 0 ? 200000 : 300);
+                run_to(target);
+                for (int j = 0; j < STRESS_TIMERS; j++)
+                {
+                        if (expect[j] != 0 && expect[j] <= TICK(now))
+                        {
+                                want[j] = 1;
+                                expect[j] = 0;
+                        }
+                        if (t[j].fired != want[j])
+                        {
+                                check(0, "stress timer fired at the wrong time");
+                                return;
+                        }
+                }
+        }
+        check(wheel.count == 0 || now < 123456789 + 5000000, "stress count");
+#undef RAND
+}
+
+int main(int argc, char *argv[])
+{
+        printf("\e[0;34mTest begin.\n");
+        test_level0();
+        test_cascade();
+        test_wraparound();
+        test_beyond_range();
+        test_del_due();
+        test_readd();
+        test_stress();
+        if (failed)
+        {
+                printf("\e[1;31m%d checks failed\n\e[0m", failed);
+                return -1;
+        }
+        printf("\e[1;32mAll timer checks passed.\n\e[0m");
+        return 0;
+}